@@ -15,6 +15,7 @@
 #include "artdaq-core-demo/Overlays/ToyFragment.hh"
 #include "artdaq-core/Data/ContainerFragment.hh"
 #include "artdaq-core/Data/Fragment.hh"
+#include "artdaq-demo/Generators/ToyHardwareInterface/ToyChannelLayout.hh"
 
 #include "TRACE/tracemf.h"  // TLOG
 #define TRACE_NAME "CheckIntegrity"
@@ -183,12 +184,16 @@ void demo::CheckIntegrity::analyze(art::Event const& evt)
 		}
 
 		{
-			auto adc_iter = bb.dataBeginADCs();
-			auto adc_end = bb.dataEndADCs();
+			// Walk the channels one after the other, whatever their layout, so
+			// that the monotonic sequence runs on from one channel to the next
+			auto layout = ToyChannelLayout::Read(frag);
+			auto adc_count = static_cast<size_t>(bb.dataEndADCs() - bb.dataBeginADCs());
 			ToyFragment::adc_t expected_adc = 1;
 
-			for (; adc_iter != adc_end; adc_iter++, expected_adc++)
+			for (size_t ii = 0; ii < adc_count; ++ii, expected_adc++)
 			{
+				auto adc_iter = bb.dataBeginADCs() + layout.Position(ii);  // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+
 				if (expected_adc > demo::ToyFragment::adc_range(frag.metadata<ToyFragment::Metadata>()->num_adc_bits))
 				{
 					expected_adc = 0;
@@ -213,8 +218,9 @@ void demo::CheckIntegrity::analyze(art::Event const& evt)
 				}
 
 				// ELF 7/10/18: As of now, distribution types 3 and 4 are uninitialized, and can therefore produce
-				// out-of-range counts.
-				if (bb.hdr_distribution_type() < 3 &&
+				// out-of-range counts. All other types (including sparse and waveform, 5 and 6) must be in range,
+				// except for streaming hits (7), whose payload is timestamped hit records rather than ADC values.
+				if (dist_type != 3 && dist_type != 4 && dist_type != 7 &&
 				    *adc_iter > demo::ToyFragment::adc_range(frag.metadata<ToyFragment::Metadata>()->num_adc_bits))
 				{
 					TLOG(TLVL_ERROR) << "Error: in run " << evt.run() << ", subrun " << evt.subRun() << ", event "
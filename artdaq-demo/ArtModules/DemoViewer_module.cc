@@ -28,6 +28,7 @@
 
 #include "artdaq-core-demo/Overlays/FragmentType.hh"
 #include "artdaq-core-demo/Overlays/ToyFragment.hh"
+#include "artdaq-demo/Generators/ToyHardwareInterface/ToyChannelLayout.hh"
 
 #include <TApplication.h>
 #include <TSystem.h>
@@ -434,7 +435,12 @@ void DemoViewer::analyze(art::Event const& e) {
     switch (fragtype) {
     case FragmentType::TOY1:
     case FragmentType::TOY2: {
-      std::copy(toyPtr->dataBeginADCs(), toyPtr->dataBeginADCs() + total_adc_values, graphs_[fid]->GetY()); 
+      // One channel after the other, whatever the layout of the payload
+      auto layout = ToyChannelLayout::Read(frag);
+      auto* adc_graph = graphs_[fid]->GetY();
+      for (std::size_t ii = 0; ii < total_adc_values; ++ii) {
+        adc_graph[ii] = toyPtr->dataBeginADCs()[layout.Position(ii)];  // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+      }
     }
       break;
 
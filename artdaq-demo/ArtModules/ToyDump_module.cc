@@ -18,6 +18,7 @@
 #include "artdaq-core-demo/Overlays/ToyFragment.hh"
 #include "artdaq-core/Data/ContainerFragment.hh"
 #include "artdaq-core/Data/Fragment.hh"
+#include "artdaq-demo/Generators/ToyHardwareInterface/ToyChannelLayout.hh"
 
 #include <algorithm>
 #include <cassert>
@@ -164,12 +165,15 @@ void demo::ToyDump::analyze(art::Event const& evt)
 	for (const auto& frag : fragments)
 	{
 		ToyFragment bb(frag);
+		auto layout = ToyChannelLayout::Read(frag);
 
 		TLOG(TLVL_INFO) << fragmentTypeToString(static_cast<demo::detail::FragmentType>(frag.type()))
 		                << " fragment " << frag.fragmentID() << " w/ seqID " << frag.sequenceID() << " and timestamp "
 		                << frag.timestamp() << " has total ADC counts = " << bb.total_adc_values()
 		                << ", trig # = " << bb.hdr_trigger_number()
-		                << ", dist_type = " << static_cast<int>(bb.hdr_distribution_type());
+		                << ", dist_type = " << static_cast<int>(bb.hdr_distribution_type())
+		                << ", channels = " << layout.Channels() << " x " << layout.SamplesPerChannel() << " samples"
+		                << (layout.GetOrder() == ToyChannelLayout::Order::interleaved ? " (interleaved)" : "");
 
 		if (frag.hasMetadata())
 		{
@@ -14,6 +14,7 @@
 
 #include "artdaq-core-demo/Overlays/FragmentType.hh"
 #include "artdaq-core-demo/Overlays/ToyFragment.hh"
+#include "artdaq-demo/Generators/ToyHardwareInterface/ToyChannelLayout.hh"
 
 #include <TAxis.h>
 #include <TCanvas.h>
@@ -468,7 +469,13 @@ void demo::WFViewer::analyze(art::Event const& e)
 			{
 				case FragmentType::TOY1:
 				case FragmentType::TOY2: {
-					std::copy(toyPtr->dataBeginADCs(), toyPtr->dataBeginADCs() + total_adc_values, graphs_[fragment_id]->GetY());  // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+					// One channel after the other, whatever the layout of the payload
+					auto layout = ToyChannelLayout::Read(frag);
+					auto* adc_graph = graphs_[fragment_id]->GetY();
+					for (std::size_t ii = 0; ii < total_adc_values; ++ii)
+					{
+						adc_graph[ii] = toyPtr->dataBeginADCs()[layout.Position(ii)];  // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+					}
 				}
 				break;
 
@@ -0,0 +1,173 @@
+#ifndef artdaq_demo_Generators_DeliveryPerturbation_hh
+#define artdaq_demo_Generators_DeliveryPerturbation_hh
+
+#include "artdaq-core/Data/Fragment.hh"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+namespace demo {
+/**
+ * \brief Holds Fragments back on their way out of a generator, to deliver them out of order and late
+ *
+ * Every Fragment which comes in is given two conditions for its release: a
+ * number of Fragments which must come in after it (drawn uniformly up to the
+ * reorder window), and a delay (drawn uniformly up to the jitter, plus the
+ * late delay for a random fraction of them). It is released once both are
+ * met, so a Fragment is never passed by more than the reorder window's worth
+ * of later ones, except by the time it spends delayed. Fragments released
+ * together leave in the order of their first condition, then their second.
+ *
+ * Nothing happens between calls to Process: a Fragment whose delay has run
+ * out waits for the next one. At the end of the data, Flush releases every
+ * Fragment still held, whatever its conditions.
+ */
+class DeliveryPerturbation
+{
+public:
+	/**
+	 * \brief How much to perturb the delivery
+	 */
+	struct Settings
+	{
+		size_t reorder_window;                 ///< Most Fragments which can come in after a Fragment and leave before it
+		std::chrono::microseconds jitter;      ///< Each Fragment is delayed by up to this much, uniformly
+		double late_fraction;                  ///< Fraction of Fragments which are delayed by late_delay on top
+		std::chrono::microseconds late_delay;  ///< Extra delay of a late Fragment
+		uint64_t seed;                         ///< Seed of the random draws
+	};
+
+	/**
+	 * \brief How the delivery has been perturbed since the last call to TakeStatistics
+	 */
+	struct Statistics
+	{
+		uint64_t released;      ///< Fragments released
+		uint64_t out_of_order;  ///< Of those, the ones released after a Fragment with a higher sequence ID
+		uint64_t late;          ///< Fragments which came in and were given the late delay
+		size_t held;            ///< Fragments being held now
+	};
+
+	/**
+	 * \brief DeliveryPerturbation Constructor
+	 * \param settings How much to perturb the delivery
+	 */
+	explicit DeliveryPerturbation(Settings const& settings)
+	    : settings_(settings)
+	    , engine_(settings.seed)
+	    , window_distn_(0, settings.reorder_window)
+	    , jitter_distn_(0, settings.jitter.count())
+	    , late_distn_(settings.late_fraction)
+	{}
+
+	/**
+	 * \brief Take in new Fragments, and hand out those whose time has come
+	 * \param frags The Fragments just read out; replaced by the Fragments released
+	 * \param now The current time
+	 */
+	void Process(artdaq::FragmentPtrs& frags, std::chrono::steady_clock::time_point now)
+	{
+		for (auto& fragment : frags)
+		{
+			Held held;
+			held.arrival = arrivals_++;
+			held.release_after = held.arrival + (settings_.reorder_window > 0 ? window_distn_(engine_) : 0);
+			held.due = now + std::chrono::microseconds(settings_.jitter.count() > 0 ? jitter_distn_(engine_) : 0);
+			if (settings_.late_fraction > 0.0 && late_distn_(engine_))
+			{
+				held.due += settings_.late_delay;
+				++late_;
+			}
+			held.fragment = std::move(fragment);
+			held_.emplace_back(std::move(held));
+		}
+		frags.clear();
+
+		auto ready = std::stable_partition(held_.begin(), held_.end(), [&](Held const& held) { return held.release_after >= arrivals_ || held.due > now; });
+		release_(ready, frags);
+	}
+
+	/**
+	 * \brief Release every Fragment still held
+	 * \param frags The Fragments released are added to the end of this list
+	 */
+	void Flush(artdaq::FragmentPtrs& frags) { release_(held_.begin(), frags); }
+
+	/**
+	 * \brief Drop every Fragment still held, and start afresh, e.g. for a new run
+	 * \return The number of Fragments dropped
+	 */
+	size_t Clear()
+	{
+		auto dropped = held_.size();
+		held_.clear();
+		highest_released_ = 0;
+		any_released_ = false;
+		return dropped;
+	}
+
+	/**
+	 * \brief Get the counts since the last call, and how many Fragments are held now
+	 * \return The counters
+	 */
+	Statistics TakeStatistics()
+	{
+		Statistics stats{released_, out_of_order_, late_, held_.size()};
+		released_ = 0;
+		out_of_order_ = 0;
+		late_ = 0;
+		return stats;
+	}
+
+private:
+	struct Held
+	{
+		artdaq::FragmentPtr fragment;
+		uint64_t arrival;
+		uint64_t release_after;  // Released once the Fragment with this arrival number has come in
+		std::chrono::steady_clock::time_point due;
+	};
+
+	void release_(std::vector<Held>::iterator first, artdaq::FragmentPtrs& frags)
+	{
+		std::sort(first, held_.end(), [](Held const& a, Held const& b) {
+			if (a.release_after != b.release_after) return a.release_after < b.release_after;
+			if (a.due != b.due) return a.due < b.due;
+			return a.arrival < b.arrival;
+		});
+		for (auto it = first; it != held_.end(); ++it)
+		{
+			auto sequence_id = it->fragment->sequenceID();
+			if (any_released_ && sequence_id < highest_released_)
+			{
+				++out_of_order_;
+			}
+			highest_released_ = any_released_ ? std::max(highest_released_, sequence_id) : sequence_id;
+			any_released_ = true;
+			++released_;
+			frags.emplace_back(std::move(it->fragment));
+		}
+		held_.erase(first, held_.end());
+	}
+
+	Settings settings_;
+	std::mt19937_64 engine_;
+	std::uniform_int_distribution<uint64_t> window_distn_;
+	std::uniform_int_distribution<int64_t> jitter_distn_;
+	std::bernoulli_distribution late_distn_;
+
+	std::vector<Held> held_;
+	uint64_t arrivals_{0};
+	artdaq::Fragment::sequence_id_t highest_released_{0};
+	bool any_released_{false};
+
+	uint64_t released_{0};
+	uint64_t out_of_order_{0};
+	uint64_t late_{0};
+};
+}  // namespace demo
+
+#endif /* artdaq_demo_Generators_DeliveryPerturbation_hh */
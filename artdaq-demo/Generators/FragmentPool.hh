@@ -0,0 +1,218 @@
+#ifndef artdaq_demo_Generators_FragmentPool_hh
+#define artdaq_demo_Generators_FragmentPool_hh
+
+#include "artdaq-core/Data/Fragment.hh"
+
+#include "SPSCQueue.hh"
+
+#include <unistd.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace demo {
+/**
+ * \brief Fragments allocated ahead of time by a background thread, in power-of-two size classes
+ *
+ * A Fragment handed downstream is freed there, so its storage can't come
+ * back to be reused; what the pool takes off the data path is the allocation
+ * itself and the first touch of the pages. A refill thread keeps up to
+ * "depth" Fragments ready in each size class that has been asked for, and
+ * the data thread takes them through a lock-free queue per class. The
+ * Fragments of a class are allocated at the size last asked of it, so that
+ * with a steady readout size they leave at exactly that size; one taken for
+ * another size is resized. A request which finds its class empty is a miss:
+ * the caller allocates for itself, and the class is stocked from then on.
+ */
+template<class METADATA>
+class FragmentPool
+{
+public:
+	static constexpr size_t kMinClassBytes = 256;  ///< Largest size in the smallest size class
+	static constexpr size_t kClasses = 40;         ///< Size classes, up to kMinClassBytes << (kClasses - 1)
+
+	/**
+	 * \brief How the pool has been doing since the last call to TakeStatistics
+	 */
+	struct Statistics
+	{
+		uint64_t hits;       ///< Requests served from the pool
+		uint64_t misses;     ///< Requests which found their class empty
+		size_t ready;        ///< Fragments currently waiting in the pool
+		size_t ready_bytes;  ///< Their total payload size (about: a class's size may have changed since they were allocated)
+	};
+
+	/**
+	 * \brief FragmentPool Constructor; starts the refill thread
+	 * \param depth How many Fragments to keep ready in each size class in use
+	 * \param refill_period How often the refill thread tops the classes up, at the latest
+	 * \param type Type of the Fragments
+	 * \param metadata Metadata of the Fragments
+	 * \param initial_bytes Size whose class is stocked from the start (0: none)
+	 */
+	FragmentPool(size_t depth, std::chrono::microseconds refill_period, artdaq::Fragment::type_t type, METADATA const& metadata, size_t initial_bytes)
+	    : depth_(depth)
+	    , refill_period_(refill_period)
+	    , type_(type)
+	    , metadata_(metadata)
+	    , running_(true)
+	{
+		for (size_t cc = 0; cc < kClasses; ++cc)
+		{
+			classes_.emplace_back(new SizeClass(depth_));
+		}
+		if (initial_bytes > 0)
+		{
+			auto& size_class = *classes_[class_of_(initial_bytes)];
+			size_class.bytes = initial_bytes;
+			size_class.wanted = true;
+		}
+		refill_thread_ = std::thread(&FragmentPool::refill_loop_, this);
+	}
+
+	/**
+	 * \brief Stop the refill thread and free the Fragments still in the pool
+	 */
+	~FragmentPool()
+	{
+		{
+			std::unique_lock<std::mutex> lk(mutex_);
+			running_ = false;
+		}
+		refill_cv_.notify_all();
+		refill_thread_.join();
+	}
+
+	FragmentPool(FragmentPool const&) = delete;
+	FragmentPool(FragmentPool&&) = delete;
+	FragmentPool& operator=(FragmentPool const&) = delete;
+	FragmentPool& operator=(FragmentPool&&) = delete;
+
+	/**
+	 * \brief Take a Fragment from the pool; data thread only
+	 * \param bytes Payload size wanted
+	 * \return A Fragment with that payload size, the pool's type and metadata, or nullptr on a miss
+	 */
+	artdaq::FragmentPtr Take(size_t bytes)
+	{
+		auto& size_class = *classes_[class_of_(bytes)];
+		size_class.bytes.store(bytes, std::memory_order_relaxed);
+		artdaq::FragmentPtr fragment;
+		if (size_class.queue.Pop(fragment))
+		{
+			hits_.fetch_add(1, std::memory_order_relaxed);
+			if (fragment->dataSizeBytes() != bytes)
+			{
+				fragment->resizeBytes(bytes);
+			}
+			return fragment;
+		}
+
+		misses_.fetch_add(1, std::memory_order_relaxed);
+		if (!size_class.wanted.exchange(true, std::memory_order_relaxed))
+		{
+			refill_cv_.notify_one();
+		}
+		return nullptr;
+	}
+
+	/**
+	 * \brief Get the hit and miss counts since the last call, and what the pool holds now
+	 * \return The pool's counters
+	 */
+	Statistics TakeStatistics()
+	{
+		Statistics stats{};
+		stats.hits = hits_.exchange(0, std::memory_order_relaxed);
+		stats.misses = misses_.exchange(0, std::memory_order_relaxed);
+		for (size_t cc = 0; cc < kClasses; ++cc)
+		{
+			auto ready = classes_[cc]->queue.Size();
+			stats.ready += ready;
+			stats.ready_bytes += ready * classes_[cc]->bytes.load(std::memory_order_relaxed);
+		}
+		return stats;
+	}
+
+private:
+	struct SizeClass
+	{
+		explicit SizeClass(size_t depth)
+		    : queue(depth)
+		    , bytes(0)
+		    , wanted(false)
+		{}
+
+		SPSCQueue<artdaq::FragmentPtr> queue;
+		std::atomic<size_t> bytes;  // Size last asked of the class, at which it is refilled
+		std::atomic<bool> wanted;
+	};
+
+	static size_t capacity_(size_t size_class) { return kMinClassBytes << size_class; }
+
+	static size_t class_of_(size_t bytes)
+	{
+		size_t size_class = 0;
+		while (size_class < kClasses - 1 && capacity_(size_class) < bytes)
+		{
+			++size_class;
+		}
+		return size_class;
+	}
+
+	// The refill thread is each queue's only producer, so a class never holds
+	// more than depth_ Fragments: Size() can only overestimate what's left.
+	// Writing one byte of each page is enough to fault it in; the payload's
+	// contents are the hardware's to fill
+	void refill_loop_()
+	{
+		auto page_bytes = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+		std::unique_lock<std::mutex> lk(mutex_);
+		while (running_)
+		{
+			lk.unlock();
+			for (size_t cc = 0; cc < kClasses; ++cc)
+			{
+				auto& size_class = *classes_[cc];
+				if (!size_class.wanted.load(std::memory_order_relaxed))
+				{
+					continue;
+				}
+				while (size_class.queue.Size() < depth_)
+				{
+					auto bytes = size_class.bytes.load(std::memory_order_relaxed);
+					artdaq::FragmentPtr fragment(artdaq::Fragment::FragmentBytes(bytes, 0, 0, type_, metadata_, 0));
+					auto* payload = fragment->dataBeginBytes();
+					for (size_t offset = 0; offset < bytes; offset += page_bytes)
+					{
+						payload[offset] = 0;  // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+					}
+					size_class.queue.Push(std::move(fragment));
+				}
+			}
+			lk.lock();
+			refill_cv_.wait_for(lk, refill_period_, [this] { return !running_; });
+		}
+	}
+
+	size_t depth_;
+	std::chrono::microseconds refill_period_;
+	artdaq::Fragment::type_t type_;
+	METADATA metadata_;
+	std::vector<std::unique_ptr<SizeClass>> classes_;
+
+	std::atomic<uint64_t> hits_{0};
+	std::atomic<uint64_t> misses_{0};
+
+	std::mutex mutex_;
+	std::condition_variable refill_cv_;
+	bool running_;
+	std::thread refill_thread_;
+};
+}  // namespace demo
+
+#endif /* artdaq_demo_Generators_FragmentPool_hh */
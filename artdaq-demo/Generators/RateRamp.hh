@@ -0,0 +1,236 @@
+#ifndef artdaq_demo_Generators_RateRamp_hh
+#define artdaq_demo_Generators_RateRamp_hh
+
+#include "StageHistogram.hh"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+namespace demo {
+/**
+ * \brief Closed-loop search for the highest trigger rate a readout chain sustains, at each of several readout sizes
+ *
+ * The ramp steps the rate up geometrically, one fixed-length step at a
+ * time. At the end of each step it looks for the signs of backpressure: a
+ * rate below the target, a growing trigger backlog, a high trigger-to-readout
+ * latency, or triggers read out only after the next one was already due. The
+ * first step which shows any of them ends the search at that size, and the
+ * rate of the step before it is the size's highest stable rate.
+ *
+ * The caller paces the triggers, and restarts its trigger clock at each new
+ * step, so that the backlog at the end of a step is what built up during it.
+ */
+class RateRamp
+{
+public:
+	/**
+	 * \brief What to ramp, and what counts as stable
+	 */
+	struct Settings
+	{
+		std::vector<size_t> sizes_bytes;     ///< Readout sizes to ramp, one after the other
+		double start_rate_hz;                ///< Rate of the first step at each size
+		double rate_factor;                  ///< Each step's rate is the previous one's times this
+		double max_rate_hz;                  ///< The ramp at a size ends after the step at or above this rate
+		std::chrono::duration<double> step;  ///< Length of a step
+		double rate_tolerance;               ///< A step is unstable if it falls short of its rate by more than this fraction
+		size_t max_backlog;                  ///< ...or if it ends with more than this many triggers due but not read out
+		double max_latency_us;               ///< ...or if the P99 trigger-to-readout latency exceeds this
+		double max_miss_fraction;            ///< ...or if more than this fraction of triggers were read out a full period late
+	};
+
+	/**
+	 * \brief The outcome of one step
+	 */
+	struct Step
+	{
+		size_t size_bytes;        ///< Readout size
+		size_t target_rate_hz;    ///< Rate the step asked for
+		double achieved_rate_hz;  ///< Rate at which triggers were actually read out
+		size_t backlog;           ///< Triggers due but not read out at the end of the step
+		double latency_p99_us;    ///< 99th percentile of the trigger-to-readout latency
+		double miss_fraction;     ///< Fraction of triggers read out after the next one was due
+		bool stable;              ///< Whether the step showed no sign of backpressure
+	};
+
+	/**
+	 * \brief The highest stable rate found at one size
+	 */
+	struct Result
+	{
+		size_t size_bytes;          ///< Readout size
+		size_t max_stable_rate_hz;  ///< Highest stable rate (0 if even the first step was unstable)
+		bool limited;               ///< False if the ramp reached max_rate_hz without finding the limit
+
+		/**
+		 * \brief Throughput at the highest stable rate
+		 * \return Bytes per second
+		 */
+		double ThroughputBytesPerSecond() const { return static_cast<double>(size_bytes) * max_stable_rate_hz; }
+	};
+
+	/**
+	 * \brief RateRamp Constructor
+	 * \param settings What to ramp, and what counts as stable
+	 */
+	explicit RateRamp(Settings settings)
+	    : settings_(std::move(settings))
+	    , size_index_(0)
+	    , rate_hz_(0)
+	    , readouts_(0)
+	    , misses_(0)
+	{}
+
+	/**
+	 * \brief Start the ramp over, from the first size and the start rate
+	 * \param now Start of the first step
+	 */
+	void Start(std::chrono::steady_clock::time_point now)
+	{
+		results_.clear();
+		size_index_ = 0;
+		begin_size_(now);
+	}
+
+	/**
+	 * \brief Whether there are steps left to take
+	 * \return False once every size has been ramped
+	 */
+	bool Running() const { return size_index_ < settings_.sizes_bytes.size(); }
+
+	/**
+	 * \brief Readout size of the current step
+	 * \return Size in bytes
+	 */
+	size_t SizeBytes() const { return settings_.sizes_bytes[size_index_]; }
+
+	/**
+	 * \brief Trigger rate of the current step
+	 * \return Rate in Hz
+	 */
+	size_t RateHz() const { return rate_hz_; }
+
+	/**
+	 * \brief Account for one readout of the current step
+	 * \param lateness How long after its trigger came due the readout started
+	 */
+	void RecordReadout(std::chrono::steady_clock::duration lateness)
+	{
+		++readouts_;
+		latency_.Record(lateness);
+		if (std::chrono::duration<double>(lateness).count() * rate_hz_ >= 1.0)
+		{
+			++misses_;
+		}
+	}
+
+	/**
+	 * \brief Whether the current step has run for its full length
+	 * \param now The current time
+	 * \return True if EndStep should be called
+	 */
+	bool StepDone(std::chrono::steady_clock::time_point now) const { return now - step_start_ >= settings_.step; }
+
+	/**
+	 * \brief Judge the current step, and move on to the next one
+	 * \param now End of the step, and start of the next one
+	 * \param backlog Triggers due but not read out at that moment
+	 * \return The outcome of the step which ended
+	 */
+	Step EndStep(std::chrono::steady_clock::time_point now, size_t backlog)
+	{
+		auto elapsed = std::chrono::duration<double>(now - step_start_).count();
+		auto latency = latency_.TakeSummary();
+
+		Step step{};
+		step.size_bytes = SizeBytes();
+		step.target_rate_hz = rate_hz_;
+		step.achieved_rate_hz = elapsed > 0 ? readouts_ / elapsed : 0.0;
+		step.backlog = backlog;
+		step.latency_p99_us = latency.p99_us;
+		step.miss_fraction = readouts_ > 0 ? static_cast<double>(misses_) / readouts_ : 0.0;
+		step.stable = step.achieved_rate_hz >= (1.0 - settings_.rate_tolerance) * rate_hz_ &&
+		              step.backlog <= settings_.max_backlog &&
+		              step.latency_p99_us <= settings_.max_latency_us &&
+		              step.miss_fraction <= settings_.max_miss_fraction;
+
+		auto& result = results_.back();
+		if (step.stable)
+		{
+			result.max_stable_rate_hz = rate_hz_;
+			if (rate_hz_ < settings_.max_rate_hz)
+			{
+				// Round, but always make progress, even at low rates
+				auto next = static_cast<size_t>(std::llround(rate_hz_ * settings_.rate_factor));
+				rate_hz_ = std::min(std::max(next, rate_hz_ + 1), static_cast<size_t>(std::ceil(settings_.max_rate_hz)));
+				begin_step_(now);
+				return step;
+			}
+			result.limited = false;
+		}
+
+		++size_index_;
+		if (Running())
+		{
+			begin_size_(now);
+		}
+		return step;
+	}
+
+	/**
+	 * \brief The highest stable rate found at each size ramped so far
+	 * \return One Result per size, in ramp order (the last one still in progress while Running)
+	 */
+	std::vector<Result> const& Results() const { return results_; }
+
+	/**
+	 * \brief The size and rate which gave the highest stable throughput
+	 * \return The best Result (all zero if there is none)
+	 */
+	Result Best() const
+	{
+		Result best{0, 0, true};
+		for (auto& result : results_)
+		{
+			if (result.ThroughputBytesPerSecond() > best.ThroughputBytesPerSecond())
+			{
+				best = result;
+			}
+		}
+		return best;
+	}
+
+private:
+	void begin_size_(std::chrono::steady_clock::time_point now)
+	{
+		results_.push_back(Result{SizeBytes(), 0, true});
+		rate_hz_ = std::max<size_t>(1, static_cast<size_t>(std::llround(settings_.start_rate_hz)));
+		begin_step_(now);
+	}
+
+	void begin_step_(std::chrono::steady_clock::time_point now)
+	{
+		step_start_ = now;
+		readouts_ = 0;
+		misses_ = 0;
+		latency_.TakeSummary();
+	}
+
+	Settings settings_;
+	std::vector<Result> results_;
+	size_t size_index_;
+	size_t rate_hz_;
+
+	// The current step
+	std::chrono::steady_clock::time_point step_start_;
+	uint64_t readouts_;
+	uint64_t misses_;
+	StageHistogram latency_;
+};
+}  // namespace demo
+
+#endif /* artdaq_demo_Generators_RateRamp_hh */
@@ -0,0 +1,176 @@
+#ifndef artdaq_demo_Generators_ReplaySimulator_hh
+#define artdaq_demo_Generators_ReplaySimulator_hh
+
+// Some C++ conventions used:
+
+// -Append a "_" to every private member function and variable
+
+#include "artdaq-core-demo/Overlays/FragmentType.hh"
+#include "artdaq-core-demo/Overlays/ToyFragment.hh"
+#include "artdaq-core-demo/Overlays/UDPFragment.hh"
+#include "artdaq-core/Data/Fragment.hh"
+#include "artdaq/Generators/CommandableFragmentGenerator.hh"
+#include "fhiclcpp/fwd.h"
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+namespace demo {
+/**
+ * \brief ReplaySimulator plays recorded data back through the DAQ
+ *
+ * The input file is memory-mapped and indexed once, when the generator is
+ * configured; during the run each record is copied straight from the
+ * mapping into the payload of its Fragment, with no staging buffer in
+ * between. Three formats are understood:
+ *
+ * "toydump": the ADC values written by ToyDump with binary_mode set. The
+ * file has no record boundaries, so it is cut into ToyFragments of
+ * nADCcounts values each.
+ *
+ * "binary_file_output": the raw Fragments (header, metadata and payload)
+ * written by artdaq's BinaryFileOutput module, as in DemoDriverWithDisk.fcl.
+ * Only Fragments whose fragment ID is one of this generator's fragment_ids
+ * are replayed, so one BoardReader per recorded board can share a file, and
+ * the Fragments recorded with the same sequence ID are sent as one event.
+ *
+ * "udp_raw": the payloads written by UDPReceiver with raw_output_enabled.
+ * String and JSON payloads are NUL-terminated; raw ones carry no length, so
+ * they are cut into records of udp_record_bytes.
+ */
+class ReplaySimulator : public artdaq::CommandableFragmentGenerator
+{
+public:
+	/**
+	 * \brief ReplaySimulator Constructor
+	 * \param ps ParameterSet used to configure ReplaySimulator
+	 *
+	 * \verbatim
+	 * ReplaySimulator accepts the following Parameters:
+	 * "input_file" (REQUIRED): The file to replay
+	 * "input_format" (Default: "binary_file_output"): "toydump", "binary_file_output" or "udp_raw"
+	 * "loop" (Default: false): Start again from the first record at the end of the file, instead of ending the run's data
+	 * "rate_hz" (Default: 0): Replay events at this rate. 0 means as fast as possible, unless the recorded timestamps
+	 *   can be used (see timestamp_ticks_per_second)
+	 * "timestamp_ticks_per_second" (Default: 0): For binary_file_output with rate_hz 0, replay events with the spacing
+	 *   of their recorded timestamps, which count this many ticks per second. 0 disables.
+	 * "rate_scale" (Default: 1.0): Multiplies the replay rate (divides the spacing between events)
+	 * "restamp" (Default: true): Give the replayed Fragments new sequence IDs and timestamps, counted from
+	 *   initial_sequence_id and starting_timestamp (in steps of timestamp_scale_factor) as ToySimulator does. Without
+	 *   it binary_file_output Fragments keep their recorded ones, which is only allowed without looping.
+	 * "initial_sequence_id" (Default: 1), "starting_timestamp" (Default: 0), "timestamp_scale_factor" (Default: 1)
+	 * "prefault_input" (Default: false): Read the whole file into memory when it is mapped, rather than on first touch
+	 * For "toydump":
+	 * "nADCcounts" (Default: 40): ADC values per Fragment; a partial record at the end of the file is dropped. The
+	 *   payload is padded with zeros to a whole ToyFragment header word
+	 * "fragment_type" (Default: "TOY2"): TOY1 or TOY2, which sets the ADC bits in the Fragment metadata
+	 * "distribution_type" (Default: 0): The distribution type to put in the ToyFragment header, see ToyHardwareInterface
+	 * For "udp_raw":
+	 * "udp_data_type" (Default: "raw"): "raw", "json" or "string", as sent by the recorded device
+	 * "udp_record_bytes" (Default: 1498): The size of each raw record (1498 is one UDP packet's worth)
+	 * "port" (Default: 6343), "ip" (Default: "127.0.0.1"): The source to put in the UDPFragment metadata
+	 * \endverbatim
+	 */
+	explicit ReplaySimulator(fhicl::ParameterSet const& ps);
+
+	/**
+	 * \brief Unmap and close the input file
+	 */
+	virtual ~ReplaySimulator();
+
+private:
+	ReplaySimulator(ReplaySimulator const&) = delete;
+	ReplaySimulator(ReplaySimulator&&) = delete;
+	ReplaySimulator& operator=(ReplaySimulator const&) = delete;
+	ReplaySimulator& operator=(ReplaySimulator&&) = delete;
+
+	/**
+	 * \brief Send the next recorded event once it is due
+	 * \param frags New FragmentPtrs will be added to this container
+	 * \return False once the end of the input has been reached (without loop), true otherwise
+	 */
+	bool getNext_(artdaq::FragmentPtrs& frags) override;
+
+	/**
+	 * \brief Rewind to the start of the input and restart the replay clock
+	 */
+	void start() override;
+
+	/**
+	 * \brief No special stop actions necessary
+	 */
+	void stop() override {}
+
+	/**
+	 * \brief No special stop actions necessary
+	 */
+	void stopNoMutex() override {}
+
+	enum class InputFormat
+	{
+		toydump,
+		binary_file_output,
+		udp_raw
+	};
+
+	struct Record
+	{
+		size_t offset;  // Byte offset of the record in the file
+		size_t bytes;   // Size of the record, without any UDP string terminator
+	};
+
+	struct Event
+	{
+		size_t first_record;
+		size_t record_count;
+		std::chrono::nanoseconds gap;  // Time since the previous event, before rate_scale
+	};
+
+	void map_input_(bool prefault);
+	void unmap_input_();
+	void build_index_();
+	void index_toydump_();
+	void index_binary_file_output_();
+	void index_udp_raw_();
+	bool wait_until_due_();
+	void emit_record_(Record const& record, artdaq::Fragment::sequence_id_t sequence_id, artdaq::Fragment::timestamp_t timestamp, artdaq::FragmentPtrs& frags);
+
+	std::string input_file_;
+	InputFormat input_format_;
+	bool loop_;
+	double rate_hz_;
+	double timestamp_ticks_per_second_;
+	double rate_scale_;
+	bool restamp_;
+	size_t initial_sequence_id_;
+	artdaq::Fragment::timestamp_t starting_timestamp_;
+	artdaq::Fragment::timestamp_t timestamp_;
+	int timestampScale_;
+
+	// The mapped input file
+	int fd_;
+	uint8_t const* data_;
+	size_t data_bytes_;
+
+	std::vector<Record> records_;
+	std::vector<Event> events_;  // The first event's gap is the one used when looping back to it
+
+	size_t next_event_;
+	size_t loops_done_;
+	std::chrono::steady_clock::time_point next_due_;
+
+	// toydump
+	size_t adcs_per_fragment_;
+	FragmentType fragment_type_;
+	ToyFragment::Metadata metadata_;
+	uint8_t distribution_type_;
+
+	// udp_raw
+	UDPFragment::Header::data_type_t udp_data_type_;
+	size_t udp_record_bytes_;
+	UDPFragment::Metadata udp_metadata_;
+};
+}  // namespace demo
+
+#endif /* artdaq_demo_Generators_ReplaySimulator_hh */
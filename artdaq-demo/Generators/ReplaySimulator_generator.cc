@@ -0,0 +1,498 @@
+// For an explanation of this class, look at its header,
+// ReplaySimulator.hh
+
+#include "artdaq-demo/Generators/ReplaySimulator.hh"
+#include "artdaq/DAQdata/Globals.hh"
+
+#include "cetlib_except/exception.h"
+#include "fhiclcpp/ParameterSet.h"
+
+#include "artdaq-core-demo/Overlays/UDPFragmentWriter.hh"
+#include "artdaq-demo/Generators/UDPReceiver.hh"
+#include "artdaq/Generators/GeneratorMacros.hh"
+
+#define TRACE_NAME "ReplaySimulator"
+#include "TRACE/tracemf.h"  // TRACE, TLOG*
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <thread>
+
+demo::ReplaySimulator::ReplaySimulator(fhicl::ParameterSet const& ps)
+    : CommandableFragmentGenerator(ps)
+    , input_file_(ps.get<std::string>("input_file"))
+    , input_format_(InputFormat::binary_file_output)
+    , loop_(ps.get<bool>("loop", false))
+    , rate_hz_(ps.get<double>("rate_hz", 0.0))
+    , timestamp_ticks_per_second_(ps.get<double>("timestamp_ticks_per_second", 0.0))
+    , rate_scale_(ps.get<double>("rate_scale", 1.0))
+    , restamp_(ps.get<bool>("restamp", true))
+    , initial_sequence_id_(ps.get<size_t>("initial_sequence_id", 1))
+    , starting_timestamp_(0)
+    , timestamp_(0)
+    , timestampScale_(ps.get<int>("timestamp_scale_factor", 1))
+    , fd_(-1)
+    , data_(nullptr)
+    , data_bytes_(0)
+    , next_event_(0)
+    , loops_done_(0)
+    , adcs_per_fragment_(ps.get<size_t>("nADCcounts", 40))
+    , fragment_type_(toFragmentType(ps.get<std::string>("fragment_type", "TOY2")))
+    , metadata_({0, 0, 0})
+    , distribution_type_(static_cast<uint8_t>(ps.get<int>("distribution_type", 0)))
+    , udp_data_type_(static_cast<UDPFragment::Header::data_type_t>(DataType::Raw))
+    , udp_record_bytes_(ps.get<size_t>("udp_record_bytes", 1498))
+    , udp_metadata_()
+{
+	auto input_format = ps.get<std::string>("input_format", "binary_file_output");
+	if (input_format == "toydump")
+	{
+		input_format_ = InputFormat::toydump;
+	}
+	else if (input_format == "udp_raw")
+	{
+		input_format_ = InputFormat::udp_raw;
+	}
+	else if (input_format != "binary_file_output")
+	{
+		throw cet::exception("ReplaySimulator") << "Unknown input_format \"" << input_format  // NOLINT(cert-err60-cpp)
+		                                        << "\"; expected \"toydump\", \"binary_file_output\" or \"udp_raw\"";
+	}
+
+	if (rate_hz_ < 0.0 || timestamp_ticks_per_second_ < 0.0 || rate_scale_ <= 0.0)
+	{
+		throw cet::exception("ReplaySimulator") << "rate_hz and timestamp_ticks_per_second must not be negative, "  // NOLINT(cert-err60-cpp)
+		                                           "and rate_scale must be positive";
+	}
+	if (loop_ && !restamp_ && input_format_ == InputFormat::binary_file_output)
+	{
+		throw cet::exception("ReplaySimulator") << "Looping would send the recorded sequence IDs more than once, "  // NOLINT(cert-err60-cpp)
+		                                           "so it requires restamp";
+	}
+
+	auto ts = ps.get<int>("starting_timestamp", 0);
+	if (ts < 0) { starting_timestamp_ = artdaq::Fragment::InvalidTimestamp; }
+	else
+	{
+		starting_timestamp_ = static_cast<artdaq::Fragment::timestamp_t>(ts);
+	}
+	timestamp_ = starting_timestamp_;
+
+	switch (fragment_type_)
+	{
+		case demo::FragmentType::TOY1:
+			metadata_.num_adc_bits = 12;
+			break;
+		case demo::FragmentType::TOY2:
+			metadata_.num_adc_bits = 14;
+			break;
+		default:
+			throw cet::exception("ReplaySimulator") << "fragment_type must be TOY1 or TOY2";  // NOLINT(cert-err60-cpp)
+	}
+	metadata_.board_serial_number = board_id() & 0xFFFF;
+
+	auto udp_data_type = ps.get<std::string>("udp_data_type", "raw");
+	if (udp_data_type == "json")
+	{
+		udp_data_type_ = static_cast<UDPFragment::Header::data_type_t>(DataType::JSON);
+	}
+	else if (udp_data_type == "string")
+	{
+		udp_data_type_ = static_cast<UDPFragment::Header::data_type_t>(DataType::String);
+	}
+	else if (udp_data_type != "raw")
+	{
+		throw cet::exception("ReplaySimulator") << "Unknown udp_data_type \"" << udp_data_type  // NOLINT(cert-err60-cpp)
+		                                        << "\"; expected \"raw\", \"json\" or \"string\"";
+	}
+	if (udp_record_bytes_ == 0)
+	{
+		throw cet::exception("ReplaySimulator") << "udp_record_bytes must be positive";  // NOLINT(cert-err60-cpp)
+	}
+
+	struct in_addr address;
+	auto ip = ps.get<std::string>("ip", "127.0.0.1");
+	if (inet_aton(ip.c_str(), &address) == 0)
+	{
+		throw cet::exception("ReplaySimulator") << "Could not translate provided IP Address: " << ip;  // NOLINT(cert-err60-cpp)
+	}
+	udp_metadata_.port = ps.get<int>("port", 6343);
+	udp_metadata_.address = address.s_addr;
+
+	map_input_(ps.get<bool>("prefault_input", false));
+	try
+	{
+		build_index_();
+	}
+	catch (...)
+	{
+		unmap_input_();
+		throw;
+	}
+}
+
+demo::ReplaySimulator::~ReplaySimulator() { unmap_input_(); }
+
+void demo::ReplaySimulator::map_input_(bool prefault)
+{
+	fd_ = open(input_file_.c_str(), O_RDONLY);  // NOLINT(cppcoreguidelines-pro-type-vararg)
+	if (fd_ < 0)
+	{
+		throw cet::exception("ReplaySimulator") << "Cannot open input file \"" << input_file_ << "\": " << strerror(errno);  // NOLINT(cert-err60-cpp)
+	}
+
+	struct stat file_stat;
+	if (fstat(fd_, &file_stat) != 0)
+	{
+		auto reason = std::string(strerror(errno));
+		unmap_input_();
+		throw cet::exception("ReplaySimulator") << "Cannot stat input file \"" << input_file_ << "\": " << reason;  // NOLINT(cert-err60-cpp)
+	}
+	if (file_stat.st_size == 0)
+	{
+		unmap_input_();
+		throw cet::exception("ReplaySimulator") << "Input file \"" << input_file_ << "\" is empty";  // NOLINT(cert-err60-cpp)
+	}
+	data_bytes_ = static_cast<size_t>(file_stat.st_size);
+
+	// A private read-only mapping: records are copied from the page cache
+	// straight into the Fragments, and the kernel reads ahead for us
+	auto* mapped = mmap(nullptr, data_bytes_, PROT_READ, MAP_PRIVATE | (prefault ? MAP_POPULATE : 0), fd_, 0);
+	if (mapped == MAP_FAILED)  // NOLINT(cppcoreguidelines-pro-type-cstyle-cast)
+	{
+		auto reason = std::string(strerror(errno));
+		data_bytes_ = 0;
+		unmap_input_();
+		throw cet::exception("ReplaySimulator") << "Cannot map input file \"" << input_file_ << "\": " << reason;  // NOLINT(cert-err60-cpp)
+	}
+	data_ = static_cast<uint8_t const*>(mapped);
+
+	// A single pass can let the pages behind it go; a looping replay wants
+	// to keep the whole file resident
+	madvise(mapped, data_bytes_, loop_ ? MADV_WILLNEED : MADV_SEQUENTIAL);
+	TLOG(TLVL_INFO) << "Mapped " << data_bytes_ << " bytes of " << input_file_;
+}
+
+void demo::ReplaySimulator::unmap_input_()
+{
+	if (data_ != nullptr)
+	{
+		munmap(const_cast<uint8_t*>(data_), data_bytes_);  // NOLINT(cppcoreguidelines-pro-type-const-cast)
+		data_ = nullptr;
+	}
+	if (fd_ >= 0)
+	{
+		close(fd_);
+		fd_ = -1;
+	}
+}
+
+void demo::ReplaySimulator::build_index_()
+{
+	switch (input_format_)
+	{
+		case InputFormat::toydump:
+			index_toydump_();
+			break;
+		case InputFormat::binary_file_output:
+			index_binary_file_output_();
+			break;
+		case InputFormat::udp_raw:
+			index_udp_raw_();
+			break;
+	}
+
+	if (events_.empty())
+	{
+		throw cet::exception("ReplaySimulator") << "Found no events to replay in \"" << input_file_ << "\"";  // NOLINT(cert-err60-cpp)
+	}
+
+	// A fixed rate overrides whatever spacing the input had
+	if (rate_hz_ > 0.0)
+	{
+		auto gap = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::duration<double>(1.0 / rate_hz_));
+		for (auto& event : events_)
+		{
+			event.gap = gap;
+		}
+	}
+
+	TLOG(TLVL_INFO) << "Indexed " << events_.size() << " events (" << records_.size() << " records) in " << input_file_;
+}
+
+void demo::ReplaySimulator::index_toydump_()
+{
+	// ToyDump writes nothing but the ADC values, back to back
+	auto record_bytes = adcs_per_fragment_ * sizeof(ToyFragment::adc_t);
+	if (record_bytes == 0)
+	{
+		throw cet::exception("ReplaySimulator") << "nADCcounts must be positive";  // NOLINT(cert-err60-cpp)
+	}
+
+	auto count = data_bytes_ / record_bytes;
+	if (data_bytes_ % record_bytes != 0)
+	{
+		TLOG(TLVL_WARNING) << "Input is not a whole number of " << adcs_per_fragment_ << "-ADC records; ignoring the last "
+		                   << data_bytes_ % record_bytes << " bytes";
+	}
+
+	records_.reserve(count);
+	events_.reserve(count);
+	for (size_t ii = 0; ii < count; ++ii)
+	{
+		records_.push_back({ii * record_bytes, record_bytes});
+		events_.push_back({ii, 1, std::chrono::nanoseconds(0)});
+	}
+}
+
+void demo::ReplaySimulator::index_binary_file_output_()
+{
+	// BinaryFileOutput writes each Fragment whole, header first, and the
+	// header's word_count is the size of the entire Fragment
+	auto ids = fragmentIDs();
+	auto header_bytes = artdaq::detail::RawFragmentHeader::num_words() * sizeof(artdaq::Fragment::value_type);
+	artdaq::Fragment::sequence_id_t last_sequence_id = 0;
+	artdaq::Fragment::timestamp_t first_timestamp = 0;
+	artdaq::Fragment::timestamp_t last_timestamp = 0;
+
+	size_t offset = 0;
+	while (offset + header_bytes <= data_bytes_)
+	{
+		artdaq::detail::RawFragmentHeader header;
+		memcpy(&header, data_ + offset, sizeof(header));  // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+
+		auto bytes = static_cast<size_t>(header.word_count) * sizeof(artdaq::Fragment::value_type);
+		if (bytes < header_bytes || offset + bytes > data_bytes_)
+		{
+			TLOG(TLVL_WARNING) << "Truncated or corrupt Fragment at byte " << offset << " of " << input_file_
+			                   << "; ignoring the rest of the file";
+			break;
+		}
+		if (header.version != artdaq::detail::RawFragmentHeader::CurrentVersion)
+		{
+			throw cet::exception("ReplaySimulator") << "The Fragment at byte " << offset << " of " << input_file_  // NOLINT(cert-err60-cpp)
+			                                        << " has header version " << header.version << ", but this build uses version "
+			                                        << artdaq::detail::RawFragmentHeader::CurrentVersion;
+		}
+
+		// System Fragments (init, end of run, ...) belong to the recording, not
+		// to this board; neither do the other boards' Fragments
+		if (artdaq::Fragment::isUserFragmentType(header.type) &&
+		    std::find(ids.begin(), ids.end(), header.fragment_id) != ids.end())
+		{
+			if (events_.empty() || header.sequence_id != last_sequence_id)
+			{
+				std::chrono::nanoseconds gap(0);
+				if (events_.empty())
+				{
+					first_timestamp = header.timestamp;
+				}
+				else if (timestamp_ticks_per_second_ > 0.0 && header.timestamp > last_timestamp)
+				{
+					gap = std::chrono::duration_cast<std::chrono::nanoseconds>(
+					    std::chrono::duration<double>((header.timestamp - last_timestamp) / timestamp_ticks_per_second_));
+				}
+				events_.push_back({records_.size(), 0, gap});
+				last_sequence_id = header.sequence_id;
+				last_timestamp = header.timestamp;
+			}
+			records_.push_back({offset, bytes});
+			++events_.back().record_count;
+		}
+		offset += bytes;
+	}
+
+	// Loop back with the average spacing of the recording
+	if (events_.size() > 1 && timestamp_ticks_per_second_ > 0.0 && last_timestamp > first_timestamp)
+	{
+		events_.front().gap = std::chrono::duration_cast<std::chrono::nanoseconds>(
+		    std::chrono::duration<double>((last_timestamp - first_timestamp) / timestamp_ticks_per_second_ / (events_.size() - 1)));
+	}
+}
+
+void demo::ReplaySimulator::index_udp_raw_()
+{
+	if (udp_data_type_ == static_cast<UDPFragment::Header::data_type_t>(DataType::Raw))
+	{
+		// Raw payloads are written without any framing, so all we can do is
+		// cut them into fixed-size records
+		for (size_t offset = 0; offset < data_bytes_; offset += udp_record_bytes_)
+		{
+			events_.push_back({records_.size(), 1, std::chrono::nanoseconds(0)});
+			records_.push_back({offset, std::min(udp_record_bytes_, data_bytes_ - offset)});
+		}
+		return;
+	}
+
+	// String and JSON payloads end at the NUL which UDPReceiver writes after each
+	size_t offset = 0;
+	while (offset < data_bytes_)
+	{
+		auto const* end = static_cast<uint8_t const*>(memchr(data_ + offset, 0, data_bytes_ - offset));  // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+		if (end == nullptr)
+		{
+			TLOG(TLVL_WARNING) << "Unterminated payload at byte " << offset << " of " << input_file_ << "; ignoring it";
+			break;
+		}
+		auto bytes = static_cast<size_t>(end - data_) - offset;
+		if (bytes > 0)
+		{
+			events_.push_back({records_.size(), 1, std::chrono::nanoseconds(0)});
+			records_.push_back({offset, bytes});
+		}
+		offset += bytes + 1;
+	}
+}
+
+bool demo::ReplaySimulator::wait_until_due_()
+{
+	// Sleep in short slices so that a stop isn't held up by a slow replay
+	auto now = std::chrono::steady_clock::now();
+	while (now < next_due_)
+	{
+		if (should_stop())
+		{
+			return false;
+		}
+		std::this_thread::sleep_until(std::min(next_due_, now + std::chrono::milliseconds(10)));
+		now = std::chrono::steady_clock::now();
+	}
+	return true;
+}
+
+void demo::ReplaySimulator::emit_record_(Record const& record, artdaq::Fragment::sequence_id_t sequence_id,
+                                         artdaq::Fragment::timestamp_t timestamp, artdaq::FragmentPtrs& frags)
+{
+	auto const* source = data_ + record.offset;  // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+
+	switch (input_format_)
+	{
+		case InputFormat::binary_file_output:
+		{
+			// The recorded Fragment already is a complete Fragment: copy it in
+			// whole, header included, then restamp the header
+			auto words = record.bytes / sizeof(artdaq::Fragment::value_type);
+			std::unique_ptr<artdaq::Fragment> fragptr(new artdaq::Fragment(words - artdaq::detail::RawFragmentHeader::num_words()));
+			memcpy(fragptr->headerAddress(), source, record.bytes);
+			if (restamp_)
+			{
+				fragptr->setSequenceID(sequence_id);
+				fragptr->setTimestamp(timestamp);
+			}
+			frags.emplace_back(std::move(fragptr));
+			break;
+		}
+		case InputFormat::toydump:
+		{
+			// The payload is padded with zeros to a whole header word, as
+			// ToyHardwareInterface does, so that no ADC value is cut off
+			auto payload_bytes = (record.bytes + sizeof(ToyFragment::Header::data_t) - 1) / sizeof(ToyFragment::Header::data_t) * sizeof(ToyFragment::Header::data_t);
+			auto bytes = sizeof(ToyFragment::Header) + payload_bytes;
+			for (auto& id : fragmentIDs())
+			{
+				frags.emplace_back(artdaq::Fragment::FragmentBytes(bytes, sequence_id, id, fragment_type_, metadata_, timestamp));
+
+				auto* header = reinterpret_cast<ToyFragment::Header*>(frags.back()->dataBeginBytes());  // NOLINT(cppcoreguidelines-pro-type-reinterpret-cast)
+				memset(header, 0, sizeof(ToyFragment::Header));
+				header->event_size = bytes / sizeof(ToyFragment::Header::data_t);
+				header->trigger_number = static_cast<uint32_t>(record.offset / record.bytes);  // The record's position in the file
+				header->distribution_type = distribution_type_;
+				auto* payload = reinterpret_cast<uint8_t*>(header + 1);  // NOLINT(cppcoreguidelines-pro-type-reinterpret-cast,cppcoreguidelines-pro-bounds-pointer-arithmetic)
+				memcpy(payload, source, record.bytes);
+				memset(payload + record.bytes, 0, payload_bytes - record.bytes);  // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+			}
+			break;
+		}
+		case InputFormat::udp_raw:
+		{
+			bool terminated = udp_data_type_ != static_cast<UDPFragment::Header::data_type_t>(DataType::Raw);
+			for (auto& id : fragmentIDs())
+			{
+				frags.emplace_back(artdaq::Fragment::FragmentBytes(0, sequence_id, id, artdaq::Fragment::FirstUserFragmentType, udp_metadata_, timestamp));
+
+				demo::UDPFragmentWriter thisFrag(*frags.back());
+				thisFrag.set_hdr_type(udp_data_type_);
+				thisFrag.resize(record.bytes + (terminated ? 1 : 0));
+				memcpy(thisFrag.dataBegin(), source, record.bytes);
+				if (terminated)
+				{
+					*(thisFrag.dataBegin() + record.bytes) = 0;  // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+				}
+			}
+			break;
+		}
+	}
+}
+
+bool demo::ReplaySimulator::getNext_(artdaq::FragmentPtrs& frags)
+{
+	if (should_stop())
+	{
+		return false;
+	}
+
+	if (next_event_ == events_.size())
+	{
+		if (!loop_)
+		{
+			TLOG(TLVL_INFO) << "getNext_: Reached the end of " << input_file_ << " after " << events_.size() << " events";
+			return false;
+		}
+		next_event_ = 0;
+		++loops_done_;
+		TLOG(TLVL_DEBUG) << "getNext_: Looping back to the start of " << input_file_ << " (loop " << loops_done_ << ")";
+	}
+
+	// Each event is due one (scaled) gap after the previous one; the very first
+	// event of the run goes out straight away. Accumulating due times, rather
+	// than sleeping for each gap, keeps the average rate right even when a
+	// slow consumer makes the replay fall behind for a while.
+	auto const& event = events_[next_event_];
+	if (next_event_ != 0 || loops_done_ != 0)
+	{
+		next_due_ += std::chrono::duration_cast<std::chrono::nanoseconds>(event.gap / rate_scale_);
+	}
+	if (!wait_until_due_())
+	{
+		return true;
+	}
+
+	TLOG(TLVL_DEBUG + 3) << "getNext_: Replaying event " << next_event_ << " (" << event.record_count << " records)";
+	for (size_t ii = 0; ii < event.record_count; ++ii)
+	{
+		emit_record_(records_[event.first_record + ii], ev_counter(), timestamp_, frags);
+	}
+	++next_event_;
+
+	if (metricMan != nullptr)
+	{
+		auto lag = std::chrono::duration<double>(std::chrono::steady_clock::now() - next_due_).count();
+		metricMan->sendMetric("Fragments Sent", ev_counter(), "Events", 3, artdaq::MetricMode::LastPoint);
+		metricMan->sendMetric("Replay Loops", loops_done_, "Loops", 3, artdaq::MetricMode::LastPoint);
+		metricMan->sendMetric("Replay Lag", lag, "s", 3, artdaq::MetricMode::Average);
+	}
+
+	ev_counter_inc();
+	timestamp_ += timestampScale_;
+	return true;
+}
+
+void demo::ReplaySimulator::start()
+{
+	while (ev_counter() < initial_sequence_id_)
+	{
+		ev_counter_inc();
+	}
+	timestamp_ = starting_timestamp_;
+	next_event_ = 0;
+	loops_done_ = 0;
+	next_due_ = std::chrono::steady_clock::now();
+}
+
+// The following macro is defined in artdaq's GeneratorMacros.hh header
+DEFINE_ARTDAQ_COMMANDABLE_GENERATOR(demo::ReplaySimulator)
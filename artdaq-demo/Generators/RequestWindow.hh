@@ -0,0 +1,111 @@
+#ifndef artdaq_demo_Generators_RequestWindow_hh
+#define artdaq_demo_Generators_RequestWindow_hh
+
+#include "artdaq-core/Data/Fragment.hh"
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+namespace demo {
+/**
+ * \brief Remembers which of the most recent sequence IDs have been handled, in bounded memory
+ *
+ * Requests arrive in (roughly) increasing sequence ID order and are seen
+ * over and over until they are removed from the RequestBuffer, so only the
+ * last few thousand IDs need remembering. The window is a ring of bits
+ * which slides forward with the highest ID inserted; an ID which has
+ * fallen behind the window is taken to have been handled already.
+ */
+class RequestWindow
+{
+public:
+	/**
+	 * \brief RequestWindow Constructor
+	 * \param size Number of sequence IDs remembered (rounded up to a multiple of 64)
+	 */
+	explicit RequestWindow(size_t size)
+	    : bits_((std::max<size_t>(size, 1) + 63) / 64, 0)
+	    , capacity_(bits_.size() * 64)
+	    , base_(0)
+	{}
+
+	/**
+	 * \brief Mark a sequence ID as handled
+	 * \param sequence_id The ID to mark
+	 * \return True if the ID had not been marked before (i.e. the request is new)
+	 */
+	bool Insert(artdaq::Fragment::sequence_id_t sequence_id)
+	{
+		if (sequence_id < base_)
+		{
+			return false;
+		}
+		if (sequence_id - base_ >= capacity_)
+		{
+			slide_(sequence_id - capacity_ + 1);
+		}
+
+		auto& word = bits_[(sequence_id % capacity_) / 64];
+		auto mask = uint64_t{1} << (sequence_id % 64);
+		if ((word & mask) != 0)
+		{
+			return false;
+		}
+		word |= mask;
+		return true;
+	}
+
+	/**
+	 * \brief Check whether a sequence ID has been handled, without marking it
+	 * \param sequence_id The ID to look up
+	 * \return True if the ID was marked, or has fallen behind the window
+	 */
+	bool Contains(artdaq::Fragment::sequence_id_t sequence_id) const
+	{
+		if (sequence_id < base_)
+		{
+			return true;
+		}
+		if (sequence_id - base_ >= capacity_)
+		{
+			return false;
+		}
+		return (bits_[(sequence_id % capacity_) / 64] & (uint64_t{1} << (sequence_id % 64))) != 0;
+	}
+
+	/**
+	 * \brief Forget every sequence ID, e.g. at the start of a run
+	 */
+	void Reset()
+	{
+		std::fill(bits_.begin(), bits_.end(), 0);
+		base_ = 0;
+	}
+
+private:
+	void slide_(artdaq::Fragment::sequence_id_t new_base)
+	{
+		if (new_base - base_ >= capacity_)
+		{
+			std::fill(bits_.begin(), bits_.end(), 0);
+		}
+		else
+		{
+			// Clear the bits of the IDs dropping out of the window, which are
+			// the slots the new IDs will reuse
+			for (auto id = base_; id < new_base; ++id)
+			{
+				bits_[(id % capacity_) / 64] &= ~(uint64_t{1} << (id % 64));
+			}
+		}
+		base_ = new_base;
+	}
+
+	std::vector<uint64_t> bits_;
+	artdaq::Fragment::sequence_id_t capacity_;
+	artdaq::Fragment::sequence_id_t base_;  // Lowest sequence ID still in the window
+};
+}  // namespace demo
+
+#endif /* artdaq_demo_Generators_RequestWindow_hh */
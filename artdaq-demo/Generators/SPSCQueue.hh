@@ -0,0 +1,111 @@
+#ifndef artdaq_demo_Generators_SPSCQueue_hh
+#define artdaq_demo_Generators_SPSCQueue_hh
+
+#include <atomic>
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+namespace demo {
+/**
+ * \brief A bounded, lock-free queue for exactly one producer thread and one consumer thread
+ *
+ * The two ends each own one index and only read the other's, so a Push or
+ * Pop is one acquire load (usually skipped, thanks to a cached copy of the
+ * other index) and one release store. The indices live on separate cache
+ * lines so that the producer and consumer don't contend for them.
+ */
+template<class T>
+class SPSCQueue
+{
+public:
+	/**
+	 * \brief SPSCQueue Constructor
+	 * \param capacity Maximum number of items held (rounded up to a power of two)
+	 */
+	explicit SPSCQueue(size_t capacity)
+	    : slots_(round_up_(capacity))
+	    , mask_(slots_.size() - 1)
+	{}
+
+	/**
+	 * \brief Append an item; producer thread only
+	 * \param item The item to append. It is only moved from if there was room for it.
+	 * \return False if the queue was full
+	 */
+	bool Push(T&& item)
+	{
+		auto tail = tail_.load(std::memory_order_relaxed);
+		if (tail - head_cache_ == slots_.size())
+		{
+			head_cache_ = head_.load(std::memory_order_acquire);
+			if (tail - head_cache_ == slots_.size())
+			{
+				return false;
+			}
+		}
+		slots_[tail & mask_] = std::move(item);
+		tail_.store(tail + 1, std::memory_order_release);
+		return true;
+	}
+
+	/**
+	 * \brief Take the oldest item; consumer thread only
+	 * \param item Receives the item
+	 * \return False if the queue was empty
+	 */
+	bool Pop(T& item)
+	{
+		auto head = head_.load(std::memory_order_relaxed);
+		if (head == tail_cache_)
+		{
+			tail_cache_ = tail_.load(std::memory_order_acquire);
+			if (head == tail_cache_)
+			{
+				return false;
+			}
+		}
+		item = std::move(slots_[head & mask_]);
+		head_.store(head + 1, std::memory_order_release);
+		return true;
+	}
+
+	/**
+	 * \brief Number of items queued; exact only when neither end is active
+	 * \return The number of items between the two indices
+	 */
+	size_t Size() const { return tail_.load(std::memory_order_acquire) - head_.load(std::memory_order_acquire); }
+
+	/**
+	 * \brief Drop every queued item; neither end may be active
+	 */
+	void Clear()
+	{
+		T item;
+		while (Pop(item))
+		{
+		}
+	}
+
+private:
+	static size_t round_up_(size_t capacity)
+	{
+		size_t size = 1;
+		while (size < capacity)
+		{
+			size <<= 1;
+		}
+		return size;
+	}
+
+	std::vector<T> slots_;
+	size_t mask_;
+
+	alignas(64) std::atomic<size_t> head_{0};  // Next slot to Pop
+	size_t tail_cache_{0};                      // The consumer's last look at tail_
+	alignas(64) std::atomic<size_t> tail_{0};  // Next slot to Push
+	size_t head_cache_{0};                      // The producer's last look at head_
+};
+}  // namespace demo
+
+#endif /* artdaq_demo_Generators_SPSCQueue_hh */
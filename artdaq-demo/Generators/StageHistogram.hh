@@ -0,0 +1,107 @@
+#ifndef artdaq_demo_Generators_StageHistogram_hh
+#define artdaq_demo_Generators_StageHistogram_hh
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+namespace demo {
+/**
+ * \brief A lock-free histogram of durations, in power-of-two nanosecond buckets
+ *
+ * Record is three relaxed atomic adds, cheap enough for the per-event path of
+ * a fragment generator and safe to call from several threads at once.
+ * TakeSummary empties the histogram and reduces what it held to a few
+ * percentiles, interpolated within their bucket.
+ */
+class StageHistogram
+{
+public:
+	static constexpr size_t kBuckets = 48;  ///< Bucket b holds durations in [2^(b-1), 2^b) ns; the last one also holds anything longer
+
+	/**
+	 * \brief What a StageHistogram held when TakeSummary was called
+	 */
+	struct Summary
+	{
+		uint64_t count;        ///< Number of durations recorded
+		double total_seconds;  ///< Sum of the durations
+		uint64_t bytes;        ///< Bytes processed during them
+		double p50_us;         ///< Median duration, in microseconds
+		double p90_us;         ///< 90th percentile, in microseconds
+		double p99_us;         ///< 99th percentile, in microseconds
+		double max_us;         ///< Upper edge of the highest non-empty bucket, in microseconds
+	};
+
+	/**
+	 * \brief Add one duration to the histogram
+	 * \param duration How long the stage took
+	 * \param bytes How many bytes it processed, for throughput (optional)
+	 */
+	void Record(std::chrono::steady_clock::duration duration, uint64_t bytes = 0)
+	{
+		auto ns = static_cast<uint64_t>(std::max<int64_t>(0, std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count()));
+		size_t bucket = ns == 0 ? 0 : std::min<size_t>(kBuckets - 1, 64 - __builtin_clzll(ns));
+		buckets_[bucket].fetch_add(1, std::memory_order_relaxed);
+		total_ns_.fetch_add(ns, std::memory_order_relaxed);
+		bytes_.fetch_add(bytes, std::memory_order_relaxed);
+	}
+
+	/**
+	 * \brief Summarize the histogram and empty it
+	 * \return Count, total, bytes and percentiles of everything recorded since the last call
+	 *
+	 * Each counter is taken and cleared atomically, but not all of them at
+	 * once, so a duration recorded concurrently may end up split between this
+	 * summary and the next one.
+	 */
+	Summary TakeSummary()
+	{
+		std::array<uint64_t, kBuckets> counts{};
+		Summary summary{};
+		for (size_t bb = 0; bb < kBuckets; ++bb)
+		{
+			counts[bb] = buckets_[bb].exchange(0, std::memory_order_relaxed);
+			summary.count += counts[bb];
+			if (counts[bb] != 0)
+			{
+				summary.max_us = upper_edge_ns_(bb) / 1000.0;
+			}
+		}
+		summary.total_seconds = total_ns_.exchange(0, std::memory_order_relaxed) * 1e-9;
+		summary.bytes = bytes_.exchange(0, std::memory_order_relaxed);
+		summary.p50_us = percentile_us_(counts, summary.count, 0.50);
+		summary.p90_us = percentile_us_(counts, summary.count, 0.90);
+		summary.p99_us = percentile_us_(counts, summary.count, 0.99);
+		return summary;
+	}
+
+private:
+	static double lower_edge_ns_(size_t bucket) { return bucket == 0 ? 0.0 : static_cast<double>(1ULL << (bucket - 1)); }
+	static double upper_edge_ns_(size_t bucket) { return static_cast<double>(1ULL << bucket); }
+
+	static double percentile_us_(std::array<uint64_t, kBuckets> const& counts, uint64_t total, double fraction)
+	{
+		auto rank = fraction * total;
+		uint64_t seen = 0;
+		for (size_t bb = 0; bb < kBuckets; ++bb)
+		{
+			if (counts[bb] != 0 && seen + counts[bb] >= rank)
+			{
+				auto within = (rank - seen) / counts[bb];
+				return (lower_edge_ns_(bb) + within * (upper_edge_ns_(bb) - lower_edge_ns_(bb))) / 1000.0;
+			}
+			seen += counts[bb];
+		}
+		return 0.0;
+	}
+
+	std::array<std::atomic<uint64_t>, kBuckets> buckets_{};
+	std::atomic<uint64_t> total_ns_{0};
+	std::atomic<uint64_t> bytes_{0};
+};
+}  // namespace demo
+
+#endif /* artdaq_demo_Generators_StageHistogram_hh */
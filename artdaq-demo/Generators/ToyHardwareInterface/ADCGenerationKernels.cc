@@ -0,0 +1,409 @@
+#include "artdaq-demo/Generators/ToyHardwareInterface/ADCGenerationKernels.hh"
+
+#include <algorithm>
+#include <cmath>
+
+// Function multiversioning: build AVX-512 and AVX2 variants of each kernel
+// next to the baseline one and let the dynamic loader pick. Other
+// compilers/architectures simply get the baseline (auto-vectorized) code.
+// The ifunc resolvers run before the sanitizer runtimes are initialized, so
+// sanitizer builds (USE_ASAN/USE_TSAN) also use the baseline code.
+#if defined(__x86_64__) && defined(__GNUC__) && !defined(__clang__) && !defined(__SANITIZE_ADDRESS__) && !defined(__SANITIZE_THREAD__)
+#define DEMO_ADC_KERNEL_CLONES __attribute__((target_clones("arch=x86-64-v4", "arch=x86-64-v3", "default")))
+#else
+#define DEMO_ADC_KERNEL_CLONES
+#endif
+
+// The kernel bodies must be inlined into each clone to be compiled for its
+// instruction set; GCC won't do so on its own for the larger ones
+#if defined(__GNUC__)
+#define DEMO_ADC_KERNEL_INLINE inline __attribute__((always_inline))
+#else
+#define DEMO_ADC_KERNEL_INLINE inline
+#endif
+
+namespace {
+// Sample indices are below 2^47, so the extra per-block (sparse) and
+// per-pulse (waveform) random words are drawn from the upper half of the
+// stream, where they can't collide with them
+constexpr uint64_t kSparseBlockIndexBase = 1ULL << 47;
+
+// The waveform is built in blocks small enough for the float scratch
+// arrays to live on the stack (and in L1)
+constexpr size_t kWaveformBlock = 1024;
+constexpr size_t kWaveformMaxTaps = 64;
+constexpr size_t kWaveformMaxTemplate = 4096;
+// Samples per FIR partial-sum and pulse-scan group; divides kWaveformBlock
+constexpr size_t kWaveformGroup = 32;
+}  // namespace
+
+demo::GaussianAliasTable::GaussianAliasTable(double mean, double sigma, ToyFragment::adc_t max_adc)
+    : entries_(static_cast<size_t>(max_adc) + 1)
+{
+	auto n = entries_.size();
+
+	// Probability of each ADC value when rounding a Gaussian deviate to the
+	// nearest integer and rejecting anything outside [0, max_adc]
+	std::vector<double> prob(n);
+	double total = 0.0;
+	for (size_t ii = 0; ii < n; ++ii)
+	{
+		auto lo = (static_cast<double>(ii) - 0.5 - mean) / (sigma * std::sqrt(2.0));
+		auto hi = (static_cast<double>(ii) + 0.5 - mean) / (sigma * std::sqrt(2.0));
+		prob[ii] = 0.5 * (std::erfc(lo) - std::erfc(hi));
+		total += prob[ii];
+	}
+
+	// Vose's method: scale so that the average bucket holds probability 1, then
+	// pair each under-full bucket with an over-full one
+	std::vector<size_t> small;
+	std::vector<size_t> large;
+	for (size_t ii = 0; ii < n; ++ii)
+	{
+		prob[ii] *= n / total;
+		(prob[ii] < 1.0 ? small : large).push_back(ii);
+	}
+
+	while (!small.empty() && !large.empty())
+	{
+		auto s = small.back();
+		small.pop_back();
+		auto l = large.back();
+
+		entries_[s] = (static_cast<uint32_t>(prob[s] * 65536.0) << 16) | static_cast<uint32_t>(l);
+
+		prob[l] -= 1.0 - prob[s];
+		if (prob[l] < 1.0)
+		{
+			large.pop_back();
+			small.push_back(l);
+		}
+	}
+
+	// Whatever is left is (up to rounding) exactly full; aliasing a bucket to
+	// itself makes the acceptance test irrelevant
+	for (auto idx : large)
+	{
+		entries_[idx] = 0xFFFF0000 | static_cast<uint32_t>(idx);
+	}
+	for (auto idx : small)
+	{
+		entries_[idx] = 0xFFFF0000 | static_cast<uint32_t>(idx);
+	}
+}
+
+demo::SparsePulseModel::SparsePulseModel(ToyFragment::adc_t baseline_adc, int noise_bits, double occupancy, size_t pulse_length_samples, ToyFragment::adc_t max_adc_value)
+    : baseline(baseline_adc)
+    , noise_mask((1u << noise_bits) - 1)
+    , pulse_threshold(static_cast<uint32_t>(std::min(1.0, std::max(0.0, occupancy)) * 4294967295.0))
+    , headroom(max_adc_value > baseline_adc ? max_adc_value - baseline_adc : 0)
+    , max_adc(max_adc_value)
+    , pulse_length(std::max<size_t>(1, pulse_length_samples))
+    , shape(pulse_length)
+{
+	// Two-sample rise, then an exponential tail decaying over a quarter of the block
+	auto tau = std::max(1.0, pulse_length / 4.0);
+	for (size_t ii = 0; ii < pulse_length; ++ii)
+	{
+		auto value = ii == 0 ? 0.5 : std::exp(-(static_cast<double>(ii) - 1.0) / tau);
+		shape[ii] = static_cast<uint32_t>(value * 65535.0);
+	}
+}
+
+demo::WaveformModel::WaveformModel(double pedestal_adc, double noise_rms, double noise_correlation, double pulse_probability, Spectrum spectrum, double amplitude, double power_law_index, double shaping_samples, int shaping_order,
+                                   ToyFragment::adc_t max_adc_value)
+    : pedestal(static_cast<float>(pedestal_adc))
+    , max_adc(static_cast<float>(max_adc_value))
+    , pulse_threshold(static_cast<uint32_t>(std::min(1.0, std::max(0.0, pulse_probability)) * 4294967295.0))
+    , spectrum_(spectrum)
+    , amplitude_(amplitude)
+    , power_law_index_(power_law_index)
+{
+	// Exponential low-pass taps, normalized so that white noise uniform on
+	// [-1, 1) (variance 1/3) comes out with the requested RMS
+	auto ntaps = static_cast<size_t>(std::min<double>(kWaveformMaxTaps, std::max(1.0, std::ceil(5.0 * noise_correlation))));
+	noise_taps.resize(ntaps);
+	double sum2 = 0.0;
+	for (size_t kk = 0; kk < ntaps; ++kk)
+	{
+		noise_taps[kk] = noise_correlation > 0.0 ? static_cast<float>(std::exp(-static_cast<double>(kk) / noise_correlation)) : 1.0f;
+		sum2 += noise_taps[kk] * noise_taps[kk];
+	}
+	for (auto& tap : noise_taps)
+	{
+		tap = static_cast<float>(tap * noise_rms * std::sqrt(3.0 / sum2));
+	}
+
+	// CR-RC^n: (t/tau)^n exp(-t/tau), peaking at t = n tau; cut the template
+	// off once the tail has dropped below 1e-3 of the peak
+	auto tau = std::max(shaping_samples, 0.1);
+	auto order = std::max(shaping_order, 1);
+	auto peak = std::pow(order, order) * std::exp(-order);
+	for (size_t jj = 0; jj < kWaveformMaxTemplate; ++jj)
+	{
+		auto t = static_cast<double>(jj) / tau;
+		auto value = std::pow(t, order) * std::exp(-t) / peak;
+		if (t > order && value < 1e-3)
+		{
+			break;
+		}
+		pulse.push_back(static_cast<float>(value));
+	}
+}
+
+float demo::WaveformModel::Amplitude(uint32_t bits) const
+{
+	// Inverse CDF of the spectrum, evaluated at u in (0, 1]
+	auto u = (static_cast<double>(bits) + 1.0) / 4294967296.0;
+	double value = 0.0;
+	switch (spectrum_)
+	{
+		case Spectrum::exponential:
+			value = -amplitude_ * std::log(u);
+			break;
+		case Spectrum::flat:
+			value = u * max_adc;
+			break;
+		case Spectrum::power_law:
+			value = amplitude_ * std::pow(u, -1.0 / (power_law_index_ - 1.0));
+			break;
+	}
+	return static_cast<float>(std::min(value, static_cast<double>(max_adc)));
+}
+
+namespace {
+// The kernels are written once as inline templates over the random stream
+// type; the exported (multiversioned) functions below instantiate them, so
+// each clone gets its own fully inlined copy of the kernel and the stream.
+template<class STREAM>
+DEMO_ADC_KERNEL_INLINE void uniform_kernel(demo::ToyFragment::adc_t* adcs, size_t begin, size_t end, STREAM const& stream, demo::ToyFragment::adc_t max_adc)
+{
+	uint32_t range = static_cast<uint32_t>(max_adc) + 1;
+	for (size_t ii = begin; ii < end; ++ii)
+	{
+		// Multiply-shift maps 32 random bits onto [0, max_adc] without a division
+		auto bits = static_cast<uint32_t>(stream(ii) >> 32);
+		adcs[ii] = static_cast<demo::ToyFragment::adc_t>((static_cast<uint64_t>(bits) * range) >> 32);  // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+	}
+}
+
+template<class STREAM>
+DEMO_ADC_KERNEL_INLINE void gaussian_kernel(demo::ToyFragment::adc_t* adcs, size_t begin, size_t end, STREAM const& stream, demo::GaussianAliasTable const& table)
+{
+	auto range = static_cast<uint32_t>(table.size());
+	auto const* entries = table.entries();
+	for (size_t ii = begin; ii < end; ++ii)
+	{
+		auto bits = stream(ii);
+		auto bucket = static_cast<int32_t>((static_cast<uint64_t>(static_cast<uint32_t>(bits)) * range) >> 32);
+		// The table load is unconditional and the select is done with a mask,
+		// so the loop body has no control flow and turns into a gather + blend
+		uint32_t entry = entries[bucket];  // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+		uint32_t alias = entry & 0xFFFF;
+		uint32_t accept = 0u - static_cast<uint32_t>(static_cast<uint32_t>(bits >> 48) < (entry >> 16));
+		adcs[ii] = static_cast<demo::ToyFragment::adc_t>(alias ^ ((static_cast<uint32_t>(bucket) ^ alias) & accept));  // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+	}
+}
+template<class STREAM>
+DEMO_ADC_KERNEL_INLINE void sparse_kernel(demo::ToyFragment::adc_t* adcs, size_t begin, size_t end, STREAM const& stream, demo::SparsePulseModel const& model)
+{
+	auto length = model.pulse_length;
+	auto const* shape = model.shape.data();
+	for (size_t block = begin / length; block * length < end; ++block)
+	{
+		// One draw per block decides whether it holds a pulse, and how big
+		auto block_bits = stream(kSparseBlockIndexBase + block);
+		uint32_t amplitude = static_cast<uint32_t>(block_bits) < model.pulse_threshold ? static_cast<uint32_t>(((block_bits >> 32) * model.headroom) >> 32) : 0;
+
+		auto block_begin = block * length;
+		auto first = std::max(begin, block_begin);
+		auto last = std::min(end, block_begin + length);
+		for (size_t ii = first; ii < last; ++ii)
+		{
+			uint32_t value = model.baseline + (static_cast<uint32_t>(stream(ii) >> 48) & model.noise_mask) + ((amplitude * shape[ii - block_begin]) >> 16);  // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+			adcs[ii] = static_cast<demo::ToyFragment::adc_t>(std::min(value, model.max_adc));                                                                // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+		}
+	}
+}
+template<class STREAM>
+DEMO_ADC_KERNEL_INLINE void waveform_kernel(demo::ToyFragment::adc_t* adcs, size_t begin, size_t end, STREAM const& stream, demo::WaveformModel const& model)
+{
+	auto ntaps = model.noise_taps.size();
+	auto const* taps = model.noise_taps.data();
+	auto tlength = model.pulse.size();
+	auto const* pulse = model.pulse.data();
+
+	// Sample i depends on the random words of the ntaps - 1 samples before it
+	// (noise filter) and of the tlength - 1 samples before it (pulses which
+	// are still ringing), so each block also looks back that far
+	auto history = std::max(ntaps, tlength) - 1;
+
+	float white[kWaveformBlock + kWaveformMaxTemplate + kWaveformGroup];
+	uint32_t starts[kWaveformBlock + kWaveformMaxTemplate + kWaveformGroup];
+	float acc[kWaveformBlock];
+
+	for (size_t block_begin = begin; block_begin < end; block_begin += kWaveformBlock)
+	{
+		auto block_end = std::min(end, block_begin + kWaveformBlock);
+		auto nsamples = block_end - block_begin;
+
+		// One random word per sample: the top 16 bits are its white noise, the
+		// bottom 32 decide whether a pulse starts there. Every word is a pure
+		// function of the sample index, so blocks and chunks join up seamlessly.
+		size_t first = block_begin >= history ? 0 : history - block_begin;  // Samples before the start of the buffer are silent
+		for (size_t jj = 0; jj < first; ++jj)
+		{
+			white[jj] = 0.0f;
+			starts[jj] = 0;
+		}
+		auto const base = block_begin - history;  // Wraps around for the first block, but base + jj never does
+		for (size_t jj = first; jj < nsamples + history; ++jj)
+		{
+			auto bits = stream(base + jj);
+			white[jj] = static_cast<float>(static_cast<int32_t>(bits >> 48) - 32768) * (1.0f / 32768.0f);
+			starts[jj] = static_cast<uint32_t>(static_cast<uint32_t>(bits) < model.pulse_threshold);
+		}
+
+		// The FIR filter and the pulse scan both work on register-sized groups
+		// of samples; a short last block is padded with silent samples so that
+		// every group is whole
+		auto scan_end = nsamples + history;
+		for (size_t jj = scan_end; jj < scan_end + kWaveformGroup; ++jj)
+		{
+			white[jj] = 0.0f;
+			starts[jj] = 0;
+		}
+
+		// FIR filter, keeping each group's partial sums in registers across taps
+		auto padded = (nsamples + kWaveformGroup - 1) / kWaveformGroup * kWaveformGroup;
+		for (size_t group = 0; group < padded; group += kWaveformGroup)
+		{
+			float part[kWaveformGroup];
+			for (size_t ii = 0; ii < kWaveformGroup; ++ii)
+			{
+				part[ii] = model.pedestal;
+			}
+			for (size_t kk = 0; kk < ntaps; ++kk)
+			{
+				auto tap = taps[kk];                             // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+				auto const* src = white + history - kk + group;  // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+				for (size_t ii = 0; ii < kWaveformGroup; ++ii)
+				{
+					part[ii] += tap * src[ii];  // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+				}
+			}
+			for (size_t ii = 0; ii < kWaveformGroup; ++ii)
+			{
+				acc[group + ii] = part[ii];
+			}
+		}
+
+		// Stamp the template of every pulse which started early enough to
+		// reach into this block. Pulses are rare, so whole groups of start
+		// flags are skipped at once and the rest is done one by one.
+		for (size_t group = history + 1 - tlength; group < scan_end; group += kWaveformGroup)
+		{
+			uint32_t any = 0;
+			for (size_t jj = group; jj < group + kWaveformGroup; ++jj)
+			{
+				any |= starts[jj];
+			}
+			if (any == 0)
+			{
+				continue;
+			}
+			for (size_t jj = group; jj < group + kWaveformGroup; ++jj)
+			{
+				if (starts[jj] == 0)
+				{
+					continue;
+				}
+				auto start = base + jj;
+				auto amplitude = model.Amplitude(static_cast<uint32_t>(stream(kSparseBlockIndexBase + start)));
+				auto from = std::max(start, block_begin);
+				auto to = std::min(start + tlength, block_end);
+				auto const* shape = pulse + (from - start);  // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+				auto* dest = acc + (from - block_begin);     // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+				for (size_t ii = 0; ii < to - from; ++ii)
+				{
+					dest[ii] += amplitude * shape[ii];  // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+				}
+			}
+		}
+
+		auto* out = adcs + block_begin;  // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+		for (size_t ii = 0; ii < nsamples; ++ii)
+		{
+			auto value = std::min(std::max(acc[ii] + 0.5f, 0.0f), model.max_adc);
+			out[ii] = static_cast<demo::ToyFragment::adc_t>(value);  // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+		}
+	}
+}
+}  // namespace
+
+DEMO_ADC_KERNEL_CLONES
+void demo::GenerateUniformADCs(ToyFragment::adc_t* adcs, size_t begin, size_t end, SplitMixStream stream, ToyFragment::adc_t max_adc)
+{
+	uniform_kernel(adcs, begin, end, stream, max_adc);
+}
+
+DEMO_ADC_KERNEL_CLONES
+void demo::GenerateUniformADCs(ToyFragment::adc_t* adcs, size_t begin, size_t end, PhiloxStream stream, ToyFragment::adc_t max_adc)
+{
+	uniform_kernel(adcs, begin, end, stream, max_adc);
+}
+
+DEMO_ADC_KERNEL_CLONES
+void demo::GenerateGaussianADCs(ToyFragment::adc_t* adcs, size_t begin, size_t end, SplitMixStream stream, GaussianAliasTable const& table)
+{
+	gaussian_kernel(adcs, begin, end, stream, table);
+}
+
+DEMO_ADC_KERNEL_CLONES
+void demo::GenerateGaussianADCs(ToyFragment::adc_t* adcs, size_t begin, size_t end, PhiloxStream stream, GaussianAliasTable const& table)
+{
+	gaussian_kernel(adcs, begin, end, stream, table);
+}
+
+DEMO_ADC_KERNEL_CLONES
+void demo::GenerateSparseADCs(ToyFragment::adc_t* adcs, size_t begin, size_t end, SplitMixStream stream, SparsePulseModel const& model)
+{
+	sparse_kernel(adcs, begin, end, stream, model);
+}
+
+DEMO_ADC_KERNEL_CLONES
+void demo::GenerateSparseADCs(ToyFragment::adc_t* adcs, size_t begin, size_t end, PhiloxStream stream, SparsePulseModel const& model)
+{
+	sparse_kernel(adcs, begin, end, stream, model);
+}
+
+DEMO_ADC_KERNEL_CLONES
+void demo::GenerateWaveformADCs(ToyFragment::adc_t* adcs, size_t begin, size_t end, SplitMixStream stream, WaveformModel const& model)
+{
+	waveform_kernel(adcs, begin, end, stream, model);
+}
+
+DEMO_ADC_KERNEL_CLONES
+void demo::GenerateWaveformADCs(ToyFragment::adc_t* adcs, size_t begin, size_t end, PhiloxStream stream, WaveformModel const& model)
+{
+	waveform_kernel(adcs, begin, end, stream, model);
+}
+
+DEMO_ADC_KERNEL_CLONES
+void demo::GenerateMonotonicADCs(ToyFragment::adc_t* adcs, size_t begin, size_t end, ToyFragment::adc_t max_adc)
+{
+	size_t period = static_cast<size_t>(max_adc) + 1;
+	size_t ii = begin;
+	size_t value = (begin + 1) % period;
+	while (ii < end)
+	{
+		// Each run up to the next wrap-around is a plain iota, which vectorizes
+		auto run = std::min(end - ii, period - value);
+		for (size_t jj = 0; jj < run; ++jj)
+		{
+			adcs[ii + jj] = static_cast<ToyFragment::adc_t>(value + jj);  // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+		}
+		ii += run;
+		value = 0;
+	}
+}
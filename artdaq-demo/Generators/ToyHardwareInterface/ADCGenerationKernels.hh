@@ -0,0 +1,313 @@
+#ifndef artdaq_demo_Generators_ToyHardwareInterface_ADCGenerationKernels_hh
+#define artdaq_demo_Generators_ToyHardwareInterface_ADCGenerationKernels_hh
+
+#include "artdaq-core-demo/Overlays/ToyFragment.hh"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// The kernels declared here are the inner loops of ToyHardwareInterface::FillBuffer.
+// They are written so that the compiler can vectorize them: there is no
+// loop-carried random-number state (sample i is a pure function of the
+// stream key and i) and no data-dependent branch per sample. On x86-64 with
+// GCC, each kernel is additionally compiled for AVX-512 and AVX2 with a
+// scalar fallback, and the best version is selected at load time.
+
+namespace demo {
+/**
+ * \brief A counter-based random stream: sample i of the stream depends only on (key, i)
+ *
+ * Because there is no sequential state, any sub-range of a buffer can be
+ * generated independently of (and concurrently with) any other sub-range,
+ * and the result is identical regardless of how the buffer is split.
+ */
+struct SplitMixStream
+{
+	uint64_t key;  ///< Stream key, derived from the random seed and the readout number
+
+	/**
+	 * \brief Get the 64 random bits associated with the given sample index
+	 * \param index Index of the sample in the stream
+	 * \return 64 random bits
+	 */
+	uint64_t operator()(uint64_t index) const
+	{
+		uint64_t z = key + (index + 1) * 0x9E3779B97F4A7C15ULL;
+		z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+		z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+		return z ^ (z >> 31);
+	}
+};
+
+/**
+ * \brief Philox4x32-10 counter-based random stream (Salmon et al., SC'11)
+ *
+ * The random bits of a sample are a keyed bijection of (fragment ID,
+ * sequence ID, sample index), with the random seed as the key, so any
+ * sample of any event can be regenerated on its own.
+ */
+struct PhiloxStream
+{
+	/**
+	 * \brief Construct the stream for one (seed, sequence ID, fragment ID) triplet
+	 * \param seed Random seed, used as the 64-bit Philox key
+	 * \param sequence_id Sequence ID of the event
+	 * \param fragment_id Fragment ID of the board
+	 */
+	PhiloxStream(uint64_t seed, uint64_t sequence_id, uint16_t fragment_id)
+	    : key0(static_cast<uint32_t>(seed))
+	    , key1(static_cast<uint32_t>(seed >> 32))
+	    , sequence_lo(static_cast<uint32_t>(sequence_id))
+	    , sequence_hi(static_cast<uint32_t>(sequence_id >> 32))
+	    , fragment(fragment_id)
+	{}
+
+	uint32_t key0;         ///< Low word of the Philox key
+	uint32_t key1;         ///< High word of the Philox key
+	uint32_t sequence_lo;  ///< Low word of the sequence ID (counter word 2)
+	uint32_t sequence_hi;  ///< High word of the sequence ID (counter word 3)
+	uint32_t fragment;     ///< Fragment ID, shares counter word 1 with bits 32-47 of the sample index
+
+	/**
+	 * \brief Get the 64 random bits associated with the given sample index
+	 * \param index Index of the sample in the fragment (must be below 2^48)
+	 * \return 64 random bits (the first two words of the Philox output block)
+	 */
+	uint64_t operator()(uint64_t index) const
+	{
+		uint32_t c0 = static_cast<uint32_t>(index);
+		uint32_t c1 = fragment | (static_cast<uint32_t>(index >> 32) << 16);
+		uint32_t c2 = sequence_lo;
+		uint32_t c3 = sequence_hi;
+		uint32_t k0 = key0;
+		uint32_t k1 = key1;
+		for (int round = 0; round < 10; ++round)
+		{
+			uint64_t p0 = static_cast<uint64_t>(0xD2511F53) * c0;
+			uint64_t p1 = static_cast<uint64_t>(0xCD9E8D57) * c2;
+			c0 = static_cast<uint32_t>(p1 >> 32) ^ c1 ^ k0;
+			c1 = static_cast<uint32_t>(p1);
+			c2 = static_cast<uint32_t>(p0 >> 32) ^ c3 ^ k1;
+			c3 = static_cast<uint32_t>(p0);
+			k0 += 0x9E3779B9;
+			k1 += 0xBB67AE85;
+		}
+		return (static_cast<uint64_t>(c1) << 32) | c0;
+	}
+};
+
+/**
+ * \brief Walker alias table for a Gaussian distribution truncated to [0, max_adc]
+ *
+ * Drawing from the table takes one random word and one table lookup, with
+ * no rejection loop, so the Gaussian kernel is as branch-free as the
+ * uniform one.
+ */
+class GaussianAliasTable
+{
+public:
+	/**
+	 * \brief Build the alias table for the discretized Gaussian
+	 * \param mean Mean of the distribution, in ADC counts
+	 * \param sigma Standard deviation of the distribution, in ADC counts
+	 * \param max_adc Largest ADC value which may be drawn
+	 */
+	GaussianAliasTable(double mean, double sigma, ToyFragment::adc_t max_adc);
+
+	/**
+	 * \brief Number of entries in the table (max_adc + 1)
+	 * \return Number of entries in the table
+	 */
+	size_t size() const { return entries_.size(); }
+
+	/**
+	 * \brief Table entries: acceptance threshold (scaled to 16 bits) in the upper half-word, alias in the lower
+	 * \return Pointer to the first entry
+	 *
+	 * Packing both into one 32-bit word means a single gather per sample.
+	 */
+	uint32_t const* entries() const { return entries_.data(); }
+
+private:
+	std::vector<uint32_t> entries_;
+};
+
+/**
+ * \brief Parameters of the sparse distribution: a noisy baseline with occasional pulses
+ *
+ * The samples are divided into blocks of pulse_length; each block holds a
+ * pulse (of random amplitude, with a fast rise and an exponential tail)
+ * with probability occupancy. Every sample gets noise_bits of uniform
+ * noise on top of the baseline. Quiet samples thus carry about noise_bits
+ * of entropy, which sets how well the data compress.
+ */
+struct SparsePulseModel
+{
+	/**
+	 * \brief Construct the model and tabulate the pulse shape
+	 * \param baseline_adc Baseline, in ADC counts
+	 * \param noise_bits Number of bits of uniform noise added to every sample
+	 * \param occupancy Fraction of blocks (and so of samples) which hold a pulse
+	 * \param pulse_length_samples Length of a pulse, in samples
+	 * \param max_adc_value Largest ADC value
+	 */
+	SparsePulseModel(ToyFragment::adc_t baseline_adc, int noise_bits, double occupancy, size_t pulse_length_samples, ToyFragment::adc_t max_adc_value);
+
+	uint32_t baseline;            ///< Baseline, in ADC counts
+	uint32_t noise_mask;          ///< Mask selecting the noise bits of a random word
+	uint32_t pulse_threshold;     ///< A block holds a pulse if its 32-bit random word is below this
+	uint32_t headroom;            ///< Largest pulse amplitude (max_adc - baseline)
+	uint32_t max_adc;             ///< Largest ADC value
+	size_t pulse_length;          ///< Length of a pulse (and of a block), in samples
+	std::vector<uint32_t> shape;  ///< Pulse shape, scaled so that 65535 is the full amplitude
+};
+
+/**
+ * \brief Parameters of the waveform distribution: a digitized detector signal
+ *
+ * Each sample is a pedestal plus correlated noise (white noise passed
+ * through an exponential FIR low-pass filter) plus the sum of all the
+ * shaped pulses which have started in the preceding template length.
+ * Pulses start at any sample with a fixed probability, with an amplitude
+ * drawn from the configured spectrum and a CR-RC^n shape.
+ */
+class WaveformModel
+{
+public:
+	/**
+	 * \brief Shape of the distribution of pulse amplitudes
+	 */
+	enum class Spectrum
+	{
+		exponential,  ///< Exponential with the given mean
+		flat,         ///< Uniform up to the largest ADC value
+		power_law     ///< dN/dA ~ A^-index above the given minimum
+	};
+
+	/**
+	 * \brief Construct the model, tabulating the noise filter and the pulse template
+	 * \param pedestal Pedestal, in ADC counts
+	 * \param noise_rms RMS of the noise, in ADC counts
+	 * \param noise_correlation Correlation length of the noise, in samples
+	 * \param pulse_probability Probability that a pulse starts at any given sample
+	 * \param spectrum Shape of the amplitude distribution
+	 * \param amplitude Mean amplitude (exponential) or minimum amplitude (power_law), in ADC counts
+	 * \param power_law_index Index of the power law (must be greater than 1)
+	 * \param shaping_samples Shaping time constant, in samples
+	 * \param shaping_order Order n of the CR-RC^n shaper
+	 * \param max_adc Largest ADC value
+	 */
+	WaveformModel(double pedestal, double noise_rms, double noise_correlation, double pulse_probability, Spectrum spectrum, double amplitude, double power_law_index, double shaping_samples, int shaping_order,
+	              ToyFragment::adc_t max_adc);
+
+	/**
+	 * \brief Draw a pulse amplitude from the spectrum
+	 * \param bits 32 random bits
+	 * \return Pulse amplitude, in ADC counts
+	 */
+	float Amplitude(uint32_t bits) const;
+
+	float pedestal;                 ///< Pedestal, in ADC counts
+	float max_adc;                  ///< Largest ADC value
+	uint32_t pulse_threshold;       ///< A pulse starts at a sample if its 32-bit random word is below this
+	std::vector<float> noise_taps;  ///< FIR filter applied to white noise uniform on [-1, 1)
+	std::vector<float> pulse;       ///< Pulse template, with a peak of 1
+
+private:
+	Spectrum spectrum_;
+	double amplitude_;
+	double power_law_index_;
+};
+
+/**
+ * \brief Fill adcs[begin, end) with values uniformly distributed on [0, max_adc]
+ * \param adcs Start of the ADC array
+ * \param begin First sample to fill
+ * \param end One past the last sample to fill
+ * \param stream Random stream to draw from
+ * \param max_adc Largest ADC value
+ */
+void GenerateUniformADCs(ToyFragment::adc_t* adcs, size_t begin, size_t end, SplitMixStream stream, ToyFragment::adc_t max_adc);
+
+/**
+ * \brief Fill adcs[begin, end) with values uniformly distributed on [0, max_adc]
+ * \param adcs Start of the ADC array
+ * \param begin First sample to fill
+ * \param end One past the last sample to fill
+ * \param stream Random stream to draw from
+ * \param max_adc Largest ADC value
+ */
+void GenerateUniformADCs(ToyFragment::adc_t* adcs, size_t begin, size_t end, PhiloxStream stream, ToyFragment::adc_t max_adc);
+
+/**
+ * \brief Fill adcs[begin, end) with values drawn from a truncated Gaussian
+ * \param adcs Start of the ADC array
+ * \param begin First sample to fill
+ * \param end One past the last sample to fill
+ * \param stream Random stream to draw from
+ * \param table Alias table describing the distribution
+ */
+void GenerateGaussianADCs(ToyFragment::adc_t* adcs, size_t begin, size_t end, SplitMixStream stream, GaussianAliasTable const& table);
+
+/**
+ * \brief Fill adcs[begin, end) with values drawn from a truncated Gaussian
+ * \param adcs Start of the ADC array
+ * \param begin First sample to fill
+ * \param end One past the last sample to fill
+ * \param stream Random stream to draw from
+ * \param table Alias table describing the distribution
+ */
+void GenerateGaussianADCs(ToyFragment::adc_t* adcs, size_t begin, size_t end, PhiloxStream stream, GaussianAliasTable const& table);
+
+/**
+ * \brief Fill adcs[begin, end) with a noisy baseline and sparse pulses
+ * \param adcs Start of the ADC array
+ * \param begin First sample to fill
+ * \param end One past the last sample to fill
+ * \param stream Random stream to draw from
+ * \param model Baseline, noise and pulse parameters
+ */
+void GenerateSparseADCs(ToyFragment::adc_t* adcs, size_t begin, size_t end, SplitMixStream stream, SparsePulseModel const& model);
+
+/**
+ * \brief Fill adcs[begin, end) with a noisy baseline and sparse pulses
+ * \param adcs Start of the ADC array
+ * \param begin First sample to fill
+ * \param end One past the last sample to fill
+ * \param stream Random stream to draw from
+ * \param model Baseline, noise and pulse parameters
+ */
+void GenerateSparseADCs(ToyFragment::adc_t* adcs, size_t begin, size_t end, PhiloxStream stream, SparsePulseModel const& model);
+
+/**
+ * \brief Fill adcs[begin, end) with a digitized waveform
+ * \param adcs Start of the ADC array
+ * \param begin First sample to fill
+ * \param end One past the last sample to fill
+ * \param stream Random stream to draw from
+ * \param model Pedestal, noise and pulse parameters
+ */
+void GenerateWaveformADCs(ToyFragment::adc_t* adcs, size_t begin, size_t end, SplitMixStream stream, WaveformModel const& model);
+
+/**
+ * \brief Fill adcs[begin, end) with a digitized waveform
+ * \param adcs Start of the ADC array
+ * \param begin First sample to fill
+ * \param end One past the last sample to fill
+ * \param stream Random stream to draw from
+ * \param model Pedestal, noise and pulse parameters
+ */
+void GenerateWaveformADCs(ToyFragment::adc_t* adcs, size_t begin, size_t end, PhiloxStream stream, WaveformModel const& model);
+
+/**
+ * \brief Fill adcs[begin, end) with the sequence 1, 2, ..., max_adc, 0, 1, ... (sample i has value (i + 1) % (max_adc + 1))
+ * \param adcs Start of the ADC array
+ * \param begin First sample to fill
+ * \param end One past the last sample to fill
+ * \param max_adc Largest ADC value
+ */
+void GenerateMonotonicADCs(ToyFragment::adc_t* adcs, size_t begin, size_t end, ToyFragment::adc_t max_adc);
+}  // namespace demo
+
+#endif /* artdaq_demo_Generators_ToyHardwareInterface_ADCGenerationKernels_hh */
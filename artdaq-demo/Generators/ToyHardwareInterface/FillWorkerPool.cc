@@ -0,0 +1,86 @@
+#include "artdaq-demo/Generators/ToyHardwareInterface/FillWorkerPool.hh"
+
+demo::FillWorkerPool::FillWorkerPool(size_t nthreads, std::function<void()> const& thread_init)
+    : task_(nullptr)
+    , nchunks_(0)
+    , next_chunk_(0)
+    , busy_workers_(0)
+    , generation_(0)
+    , stop_(false)
+{
+	for (size_t ii = 1; ii < nthreads; ++ii)
+	{
+		workers_.emplace_back([this, thread_init] {
+			if (thread_init)
+			{
+				thread_init();
+			}
+			worker_loop_();
+		});
+	}
+}
+
+demo::FillWorkerPool::~FillWorkerPool()
+{
+	{
+		std::unique_lock<std::mutex> lk(mutex_);
+		stop_ = true;
+	}
+	work_cv_.notify_all();
+	for (auto& worker : workers_)
+	{
+		worker.join();
+	}
+}
+
+void demo::FillWorkerPool::Run(size_t nchunks, std::function<void(size_t)> const& task)
+{
+	{
+		std::unique_lock<std::mutex> lk(mutex_);
+		task_ = &task;
+		nchunks_ = nchunks;
+		next_chunk_ = 0;
+		busy_workers_ = workers_.size();
+		++generation_;
+	}
+	work_cv_.notify_all();
+
+	process_chunks_();
+
+	std::unique_lock<std::mutex> lk(mutex_);
+	done_cv_.wait(lk, [this] { return busy_workers_ == 0; });
+	task_ = nullptr;
+}
+
+void demo::FillWorkerPool::worker_loop_()
+{
+	uint64_t seen_generation = 0;
+	std::unique_lock<std::mutex> lk(mutex_);
+	while (true)
+	{
+		work_cv_.wait(lk, [&] { return stop_ || generation_ != seen_generation; });
+		if (stop_)
+		{
+			return;
+		}
+		seen_generation = generation_;
+
+		lk.unlock();
+		process_chunks_();
+		lk.lock();
+
+		if (--busy_workers_ == 0)
+		{
+			done_cv_.notify_one();
+		}
+	}
+}
+
+void demo::FillWorkerPool::process_chunks_()
+{
+	// task_ and nchunks_ are only modified while no thread is in here
+	for (auto chunk = next_chunk_.fetch_add(1); chunk < nchunks_; chunk = next_chunk_.fetch_add(1))
+	{
+		(*task_)(chunk);
+	}
+}
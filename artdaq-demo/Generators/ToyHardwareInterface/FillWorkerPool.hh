@@ -0,0 +1,73 @@
+#ifndef artdaq_demo_Generators_ToyHardwareInterface_FillWorkerPool_hh
+#define artdaq_demo_Generators_ToyHardwareInterface_FillWorkerPool_hh
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace demo {
+/**
+ * \brief A persistent pool of threads used by ToyHardwareInterface to fill one readout buffer in parallel
+ *
+ * The work is described as a number of independent chunks; each call to Run
+ * hands the chunks out to the pool threads and to the calling thread, and
+ * returns once every chunk has been processed. The threads are started once,
+ * at construction, and sleep between calls.
+ */
+class FillWorkerPool
+{
+public:
+	/**
+	 * \brief Start the pool
+	 * \param nthreads Total number of threads working on each Run call, including the caller
+	 * \param thread_init Called by each pool thread when it starts, e.g. to set its CPU affinity (optional)
+	 */
+	explicit FillWorkerPool(size_t nthreads, std::function<void()> const& thread_init = nullptr);
+
+	/**
+	 * \brief Stop and join the pool threads
+	 */
+	~FillWorkerPool();
+
+	/**
+	 * \brief Process chunks [0, nchunks) using the pool threads and the calling thread
+	 * \param nchunks Number of chunks
+	 * \param task Function called once for each chunk index
+	 */
+	void Run(size_t nchunks, std::function<void(size_t)> const& task);
+
+	/**
+	 * \brief Get the number of threads working on each Run call, including the caller
+	 * \return Number of threads
+	 */
+	size_t size() const { return workers_.size() + 1; }
+
+private:
+	FillWorkerPool(FillWorkerPool const&) = delete;
+	FillWorkerPool(FillWorkerPool&&) = delete;
+	FillWorkerPool& operator=(FillWorkerPool const&) = delete;
+	FillWorkerPool& operator=(FillWorkerPool&&) = delete;
+
+	void worker_loop_();
+	void process_chunks_();
+
+	std::vector<std::thread> workers_;
+	std::mutex mutex_;
+	std::condition_variable work_cv_;
+	std::condition_variable done_cv_;
+
+	std::function<void(size_t)> const* task_;
+	size_t nchunks_;
+	std::atomic<size_t> next_chunk_;
+	size_t busy_workers_;
+	uint64_t generation_;
+	bool stop_;
+};
+}  // namespace demo
+
+#endif /* artdaq_demo_Generators_ToyHardwareInterface_FillWorkerPool_hh */
@@ -0,0 +1,205 @@
+#include "artdaq-demo/Generators/ToyHardwareInterface/ReadoutMemory.hh"
+#define TRACE_NAME "ReadoutMemory"
+#include "artdaq/DAQdata/Globals.hh"
+
+#include "cetlib_except/exception.h"
+#include "fhiclcpp/ParameterSet.h"
+
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+namespace {
+// From <numaif.h>; mbind is called through syscall() so as not to need libnuma
+constexpr int kMemoryPolicyBind = 2;        // MPOL_BIND
+constexpr unsigned kMoveExisting = 1 << 1;  // MPOL_MF_MOVE
+
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT 26
+#endif
+
+// Parse a kernel CPU list such as "0-7,16-23"
+std::vector<int> parse_cpu_list(std::string const& list)
+{
+	std::vector<int> cpus;
+	std::istringstream items(list);
+	std::string item;
+	while (std::getline(items, item, ','))
+	{
+		auto dash = item.find('-');
+		auto first = std::stoi(item.substr(0, dash));
+		auto last = dash == std::string::npos ? first : std::stoi(item.substr(dash + 1));
+		for (auto cpu = first; cpu <= last; ++cpu)
+		{
+			cpus.push_back(cpu);
+		}
+	}
+	return cpus;
+}
+}  // namespace
+
+demo::ReadoutMemory::ReadoutMemory(fhicl::ParameterSet const& ps)
+    : pages_(Pages::normal)
+    , mlock_(ps.get<bool>("readout_buffer_mlock", false))
+    , numa_node_(ps.get<int>("numa_node", -1))
+{
+	auto pages = ps.get<std::string>("readout_buffer_pages", "normal");
+	if (pages == "transparent")
+	{
+		pages_ = Pages::transparent;
+	}
+	else if (pages == "2MB")
+	{
+		pages_ = Pages::huge_2mb;
+	}
+	else if (pages == "1GB")
+	{
+		pages_ = Pages::huge_1gb;
+	}
+	else if (pages != "normal")
+	{
+		throw cet::exception("ReadoutMemory") << "Unknown readout_buffer_pages \"" << pages << "\"; expected \"normal\", \"transparent\", \"2MB\" or \"1GB\"";  // NOLINT(cert-err60-cpp)
+	}
+
+	if (numa_node_ >= 0)
+	{
+		std::ifstream cpulist("/sys/devices/system/node/node" + std::to_string(numa_node_) + "/cpulist");
+		std::string list;
+		if (!std::getline(cpulist, list) || list.empty())
+		{
+			throw cet::exception("ReadoutMemory") << "NUMA node " << numa_node_ << " does not exist (or has no CPUs)";  // NOLINT(cert-err60-cpp)
+		}
+		node_cpus_ = parse_cpu_list(list);
+		TLOG(TLVL_INFO) << "Readout buffers and threads will be bound to NUMA node " << numa_node_ << " (CPUs " << list << ")";
+	}
+}
+
+char* demo::ReadoutMemory::Allocate(size_t bytes)
+{
+	if (!mapped_())
+	{
+		return reinterpret_cast<char*>(new uint8_t[bytes]);  // NOLINT(cppcoreguidelines-pro-type-reinterpret-cast)
+	}
+
+	// Huge pages need the length to be a whole number of them
+	auto round_up = [bytes](size_t page) { return (bytes + page - 1) / page * page; };
+	size_t length = round_up(pages_ == Pages::huge_1gb ? (1UL << 30) : pages_ == Pages::normal ? static_cast<size_t>(sysconf(_SC_PAGESIZE)) : (1UL << 21));
+
+	void* buffer = MAP_FAILED;
+	if (pages_ == Pages::huge_2mb || pages_ == Pages::huge_1gb)
+	{
+		int size_flag = (pages_ == Pages::huge_1gb ? 30 : 21) << MAP_HUGE_SHIFT;
+		buffer = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | size_flag, -1, 0);
+		if (buffer == MAP_FAILED)
+		{
+			TLOG(TLVL_WARNING) << "Could not map " << length << " bytes of " << (pages_ == Pages::huge_1gb ? "1GB" : "2MB")
+			                   << " huge pages (" << strerror(errno) << "); falling back to transparent huge pages";
+		}
+	}
+	if (buffer == MAP_FAILED)
+	{
+		if (pages_ == Pages::huge_1gb)
+		{
+			length = round_up(1UL << 21);
+		}
+		buffer = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (buffer == MAP_FAILED)
+		{
+			throw cet::exception("ReadoutMemory") << "Could not map a " << length << " byte readout buffer: " << strerror(errno);  // NOLINT(cert-err60-cpp)
+		}
+		if (pages_ != Pages::normal && madvise(buffer, length, MADV_HUGEPAGE) != 0)
+		{
+			TLOG(TLVL_WARNING) << "madvise(MADV_HUGEPAGE) failed: " << strerror(errno);
+		}
+	}
+
+	// Set the policy before anything touches the pages, so that they are
+	// allocated on the node in the first place
+	if (numa_node_ >= 0)
+	{
+		std::vector<unsigned long> nodemask(numa_node_ / (8 * sizeof(unsigned long)) + 1, 0);
+		nodemask[numa_node_ / (8 * sizeof(unsigned long))] |= 1UL << (numa_node_ % (8 * sizeof(unsigned long)));
+		if (syscall(SYS_mbind, buffer, length, kMemoryPolicyBind, nodemask.data(), nodemask.size() * 8 * sizeof(unsigned long) + 1, kMoveExisting) != 0)
+		{
+			TLOG(TLVL_WARNING) << "Could not bind a readout buffer to NUMA node " << numa_node_ << ": " << strerror(errno);
+		}
+	}
+	if (mlock_ && mlock(buffer, length) != 0)
+	{
+		TLOG(TLVL_WARNING) << "Could not lock a " << length << " byte readout buffer into RAM (" << strerror(errno) << "); check RLIMIT_MEMLOCK";
+	}
+
+	std::unique_lock<std::mutex> lk(mutex_);
+	mappings_[static_cast<char const*>(buffer)] = length;
+	return static_cast<char*>(buffer);
+}
+
+void demo::ReadoutMemory::Free(char const* buffer)
+{
+	if (!mapped_())
+	{
+		delete[] buffer;
+		return;
+	}
+
+	size_t length = 0;
+	{
+		std::unique_lock<std::mutex> lk(mutex_);
+		auto mapping = mappings_.find(buffer);
+		if (mapping == mappings_.end())
+		{
+			throw cet::exception("ReadoutMemory") << "Attempt to free a buffer which was not allocated as a readout buffer";  // NOLINT(cert-err60-cpp)
+		}
+		length = mapping->second;
+		mappings_.erase(mapping);
+	}
+	munmap(const_cast<char*>(buffer), length);  // NOLINT(cppcoreguidelines-pro-type-const-cast)
+}
+
+void demo::ReadoutMemory::Prefault(char* buffer, size_t bytes)
+{
+	if (bytes == 0)
+	{
+		return;
+	}
+	auto page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+	for (size_t offset = 0; offset < bytes; offset += page)
+	{
+		buffer[offset] = 0;  // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+	}
+	buffer[bytes - 1] = 0;  // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+}
+
+void demo::ReadoutMemory::BindThread() const
+{
+	if (node_cpus_.empty())
+	{
+		return;
+	}
+
+	cpu_set_t cpus;
+	CPU_ZERO(&cpus);
+	for (auto cpu : node_cpus_)
+	{
+		CPU_SET(cpu, &cpus);
+	}
+	auto rc = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+	if (rc != 0)
+	{
+		TLOG(TLVL_WARNING) << "Could not bind a readout thread to NUMA node " << numa_node_ << ": " << strerror(rc);
+	}
+}
+
+demo::ReadoutMemory::PageFaults demo::ReadoutMemory::GetPageFaults()
+{
+	rusage usage{};
+	getrusage(RUSAGE_SELF, &usage);
+	return PageFaults{static_cast<uint64_t>(usage.ru_minflt), static_cast<uint64_t>(usage.ru_majflt)};
+}
@@ -0,0 +1,102 @@
+#ifndef artdaq_demo_Generators_ToyHardwareInterface_ReadoutMemory_hh
+#define artdaq_demo_Generators_ToyHardwareInterface_ReadoutMemory_hh
+
+#include "fhiclcpp/fwd.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <vector>
+
+namespace demo {
+/**
+ * \brief Places ToyHardwareInterface's readout buffers in memory: page size, locking and NUMA node
+ *
+ * With the default settings buffers come from new[], as they always have.
+ * Otherwise each buffer is mapped on its own, so that it can be backed by
+ * huge pages, bound to a NUMA node and locked into RAM before it is first
+ * touched. The readout threads can be bound to the same node's CPUs, so
+ * that they fill the buffers without crossing the socket interconnect.
+ */
+class ReadoutMemory
+{
+public:
+	/**
+	 * \brief ReadoutMemory Constructor
+	 * \param ps ParameterSet used to configure ReadoutMemory (the ToyHardwareInterface's)
+	 *
+	 * \verbatim
+	 * ReadoutMemory accepts the following Parameters:
+	 * "readout_buffer_pages" (Default: "normal"): "normal", "transparent" (ask the kernel for transparent huge pages),
+	 *   "2MB" or "1GB" (explicit huge pages, which must have been reserved, e.g. through
+	 *   /sys/kernel/mm/hugepages; if none are free the buffer falls back to transparent huge pages, with a warning)
+	 * "readout_buffer_mlock" (Default: false): Lock the buffers into RAM. Needs a large enough RLIMIT_MEMLOCK.
+	 * "numa_node" (Default: -1): Bind the buffers to this NUMA node's memory, and the readout threads to its CPUs.
+	 *   -1 leaves both to the kernel.
+	 * \endverbatim
+	 */
+	explicit ReadoutMemory(fhicl::ParameterSet const& ps);
+
+	/**
+	 * \brief Get a buffer placed according to the configuration
+	 * \param bytes Size of the buffer
+	 * \return The buffer, to be released with Free
+	 */
+	char* Allocate(size_t bytes);
+
+	/**
+	 * \brief Release a buffer obtained from Allocate
+	 * \param buffer The buffer
+	 */
+	void Free(char const* buffer);
+
+	/**
+	 * \brief Fault in every page of a buffer, by writing to it
+	 * \param buffer The buffer
+	 * \param bytes Its size
+	 */
+	static void Prefault(char* buffer, size_t bytes);
+
+	/**
+	 * \brief Bind the calling thread to the CPUs of the configured NUMA node (if any)
+	 */
+	void BindThread() const;
+
+	/**
+	 * \brief Page faults taken by this process so far
+	 */
+	struct PageFaults
+	{
+		uint64_t minor;  ///< Faults served without I/O (including first touches of fresh pages)
+		uint64_t major;  ///< Faults which had to wait for I/O
+	};
+
+	/**
+	 * \brief Read the process's page fault counters
+	 * \return The counters, from getrusage
+	 */
+	static PageFaults GetPageFaults();
+
+private:
+	enum class Pages
+	{
+		normal,
+		transparent,
+		huge_2mb,
+		huge_1gb
+	};
+
+	bool mapped_() const { return pages_ != Pages::normal || mlock_ || numa_node_ >= 0; }
+
+	Pages pages_;
+	bool mlock_;
+	int numa_node_;
+	std::vector<int> node_cpus_;
+
+	std::mutex mutex_;
+	std::map<char const*, size_t> mappings_;  // Buffer -> mapped length
+};
+}  // namespace demo
+
+#endif /* artdaq_demo_Generators_ToyHardwareInterface_ReadoutMemory_hh */
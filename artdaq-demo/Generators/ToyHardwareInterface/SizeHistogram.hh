@@ -0,0 +1,115 @@
+#ifndef artdaq_demo_Generators_ToyHardwareInterface_SizeHistogram_hh
+#define artdaq_demo_Generators_ToyHardwareInterface_SizeHistogram_hh
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace demo {
+/**
+ * \brief A lock-free histogram of readout sizes, in log-linear buckets
+ *
+ * Each power of two is split into eight buckets, so that a percentile is
+ * known to within 12.5% whatever the size. Percentiles are reported as the
+ * upper edge of their bucket, erring on the large side, as befits a number
+ * used to size buffers. Record is safe to call from several threads at once.
+ */
+class SizeHistogram
+{
+public:
+	static constexpr size_t kSubBuckets = 8;                            ///< Buckets per power of two
+	static constexpr size_t kBuckets = kSubBuckets + 61 * kSubBuckets;  ///< Sizes below kSubBuckets get a bucket each
+
+	/**
+	 * \brief What a SizeHistogram held when TakeSummary was called
+	 */
+	struct Summary
+	{
+		uint64_t count;     ///< Number of sizes recorded
+		double mean_bytes;  ///< Mean size
+		size_t p50_bytes;   ///< Median size (upper edge of its bucket)
+		size_t p99_bytes;   ///< 99th percentile (upper edge of its bucket)
+		size_t max_bytes;   ///< Largest size, exactly
+	};
+
+	/**
+	 * \brief Add one size to the histogram
+	 * \param bytes The size
+	 */
+	void Record(size_t bytes)
+	{
+		buckets_[bucket_(bytes)].fetch_add(1, std::memory_order_relaxed);
+		total_bytes_.fetch_add(bytes, std::memory_order_relaxed);
+		auto max = max_bytes_.load(std::memory_order_relaxed);
+		while (bytes > max && !max_bytes_.compare_exchange_weak(max, bytes, std::memory_order_relaxed))
+		{
+		}
+	}
+
+	/**
+	 * \brief Summarize the histogram and empty it
+	 * \return Count, mean, percentiles and maximum of everything recorded since the last call
+	 */
+	Summary TakeSummary()
+	{
+		std::array<uint64_t, kBuckets> counts{};
+		Summary summary{};
+		for (size_t bb = 0; bb < kBuckets; ++bb)
+		{
+			counts[bb] = buckets_[bb].exchange(0, std::memory_order_relaxed);
+			summary.count += counts[bb];
+		}
+		auto total = total_bytes_.exchange(0, std::memory_order_relaxed);
+		summary.mean_bytes = summary.count > 0 ? static_cast<double>(total) / summary.count : 0.0;
+		summary.max_bytes = max_bytes_.exchange(0, std::memory_order_relaxed);
+		summary.p50_bytes = std::min(percentile_(counts, summary.count, 0.50), summary.max_bytes);
+		summary.p99_bytes = std::min(percentile_(counts, summary.count, 0.99), summary.max_bytes);
+		return summary;
+	}
+
+private:
+	static size_t bucket_(size_t bytes)
+	{
+		if (bytes < kSubBuckets)
+		{
+			return bytes;
+		}
+		size_t exponent = 63 - __builtin_clzll(bytes);  // At least 3
+		return kSubBuckets * (exponent - 2) + ((bytes >> (exponent - 3)) - kSubBuckets);
+	}
+
+	static size_t upper_edge_(size_t bucket)
+	{
+		if (bucket < kSubBuckets)
+		{
+			return bucket;
+		}
+		size_t exponent = bucket / kSubBuckets + 2;
+		size_t sub = bucket % kSubBuckets;
+		return ((kSubBuckets + sub + 1) << (exponent - 3)) - 1;
+	}
+
+	static size_t percentile_(std::array<uint64_t, kBuckets> const& counts, uint64_t total, double fraction)
+	{
+		auto rank = fraction * total;
+		uint64_t seen = 0;
+		for (size_t bb = 0; bb < kBuckets; ++bb)
+		{
+			seen += counts[bb];
+			if (counts[bb] != 0 && seen >= rank)
+			{
+				return upper_edge_(bb);
+			}
+		}
+		return 0;
+	}
+
+	std::array<std::atomic<uint64_t>, kBuckets> buckets_{};
+	std::atomic<uint64_t> total_bytes_{0};
+	std::atomic<size_t> max_bytes_{0};
+};
+}  // namespace demo
+
+#endif /* artdaq_demo_Generators_ToyHardwareInterface_SizeHistogram_hh */
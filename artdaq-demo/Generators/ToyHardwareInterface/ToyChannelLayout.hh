@@ -0,0 +1,183 @@
+#ifndef artdaq_demo_Generators_ToyHardwareInterface_ToyChannelLayout_hh
+#define artdaq_demo_Generators_ToyHardwareInterface_ToyChannelLayout_hh
+
+#include "artdaq-core-demo/Overlays/ToyFragment.hh"
+#include "artdaq-core/Data/Fragment.hh"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+namespace demo {
+/**
+ * \brief Where each channel's samples are in the payload of a multi-channel ToyFragment
+ *
+ * ToyHardwareInterface reads out "channels" channels of M samples each, the
+ * channels * M ADC values being either channel-major (every sample of channel
+ * 0, then every sample of channel 1, ...) or interleaved (sample 0 of every
+ * channel, then sample 1, ...). Whatever ADC values are left over, padding
+ * the payload to a whole header word, follow in both layouts and belong to
+ * no channel.
+ *
+ * The layout is kept in the upper 24 bits of the third ToyFragment header
+ * word, which the ToyFragment overlay leaves unused: a tag byte, one value
+ * for each order, then the channel count. Those bits used to be left
+ * uninitialized, so a header is only taken to hold a layout if the whole tag
+ * byte matches and there is at least one sample per channel; anything else,
+ * like a payload written before there were channels, reads as a single
+ * channel. The channel count need not divide the number of ADC values, as
+ * the values left over belong to no channel.
+ */
+class ToyChannelLayout
+{
+public:
+	/**
+	 * \brief Order of the ADC values of the channels
+	 */
+	enum class Order : uint8_t
+	{
+		channel_major,  ///< Every sample of a channel, then the next channel
+		interleaved     ///< One sample of every channel, then the next sample
+	};
+
+	static constexpr size_t kMaxChannels = 0xFFFF;  ///< Most channels the header can record
+
+	/**
+	 * \brief ToyChannelLayout Constructor
+	 * \param channels Number of channels
+	 * \param samples_per_channel Number of samples of each channel
+	 * \param order Order of the ADC values
+	 */
+	ToyChannelLayout(size_t channels, size_t samples_per_channel, Order order)
+	    : channels_(channels)
+	    , samples_(samples_per_channel)
+	    , order_(order)
+	{}
+
+	/**
+	 * \brief Read the layout of a ToyFragment from its header
+	 * \param fragment A TOY1 or TOY2 Fragment
+	 * \return The layout recorded in the header, or a single channel if there is none
+	 */
+	static ToyChannelLayout Read(artdaq::Fragment const& fragment)
+	{
+		if (fragment.dataSizeBytes() < sizeof(ToyFragment::Header))
+		{
+			return ToyChannelLayout(1, 0, Order::channel_major);
+		}
+		auto total_adc_values = ToyFragment(fragment).total_adc_values();
+		auto word = read_word_(fragment.dataBeginBytes());
+		auto tag = (word >> kTagShift) & 0xFF;
+		auto channels = word >> kChannelsShift;
+		if ((tag != kTagChannelMajor && tag != kTagInterleaved) || channels == 0 || channels > total_adc_values)
+		{
+			return ToyChannelLayout(1, total_adc_values, Order::channel_major);
+		}
+		return ToyChannelLayout(channels, total_adc_values / channels, tag == kTagInterleaved ? Order::interleaved : Order::channel_major);
+	}
+
+	/**
+	 * \brief Record a layout in a ToyFragment header; the rest of the header is left alone
+	 * \param header Header to write to
+	 * \param channels Number of channels (1 to kMaxChannels)
+	 * \param order Order of the ADC values
+	 */
+	static void Write(ToyFragment::Header* header, size_t channels, Order order)
+	{
+		auto* bytes = reinterpret_cast<uint8_t*>(header);  // NOLINT(cppcoreguidelines-pro-type-reinterpret-cast)
+		auto word = read_word_(bytes) & kKeepMask;
+		word |= (order == Order::interleaved ? kTagInterleaved : kTagChannelMajor) << kTagShift;
+		word |= static_cast<ToyFragment::Header::data_t>(channels) << kChannelsShift;
+		write_word_(bytes, word);
+	}
+
+	/**
+	 * \brief Mark a ToyFragment header as holding no channels, e.g. for a payload of hits
+	 * \param header Header to write to
+	 */
+	static void Erase(ToyFragment::Header* header)
+	{
+		auto* bytes = reinterpret_cast<uint8_t*>(header);  // NOLINT(cppcoreguidelines-pro-type-reinterpret-cast)
+		write_word_(bytes, read_word_(bytes) & kKeepMask);
+	}
+
+	/**
+	 * \brief Number of channels
+	 * \return The channel count
+	 */
+	size_t Channels() const { return channels_; }
+
+	/**
+	 * \brief Number of samples of each channel
+	 * \return The samples per channel
+	 */
+	size_t SamplesPerChannel() const { return samples_; }
+
+	/**
+	 * \brief Order of the ADC values
+	 * \return Channel-major or interleaved
+	 */
+	Order GetOrder() const { return order_; }
+
+	/**
+	 * \brief Where a sample is in the payload
+	 * \param channel Channel of the sample
+	 * \param sample Sample number within the channel
+	 * \return Index of the sample's ADC value, from ToyFragment::dataBeginADCs
+	 */
+	size_t Index(size_t channel, size_t sample) const
+	{
+		return order_ == Order::interleaved ? sample * channels_ + channel : channel * samples_ + sample;
+	}
+
+	/**
+	 * \brief Distance between consecutive samples of a channel, in ADC values
+	 * \return 1 when channel-major, the channel count when interleaved
+	 */
+	size_t Stride() const { return order_ == Order::interleaved ? channels_ : 1; }
+
+	/**
+	 * \brief Where the n-th ADC value in channel-major order is in the payload
+	 * \param n Index of the value as if the payload were channel-major
+	 * \return Index of the value, from ToyFragment::dataBeginADCs
+	 *
+	 * Lets code which walks the whole payload see each channel in turn,
+	 * whatever the layout.
+	 */
+	size_t Position(size_t n) const
+	{
+		if (order_ == Order::channel_major || n >= channels_ * samples_)
+		{
+			return n;
+		}
+		return Index(n / samples_, n % samples_);
+	}
+
+private:
+	static constexpr size_t kWord = 2;                              // Header word with distribution_type and the spare bits
+	static constexpr ToyFragment::Header::data_t kKeepMask = 0xFF;  // distribution_type
+	static constexpr ToyFragment::Header::data_t kTagChannelMajor = 0x5A;
+	static constexpr ToyFragment::Header::data_t kTagInterleaved = 0xA5;
+	static constexpr unsigned kTagShift = 8;
+	static constexpr unsigned kChannelsShift = 16;
+	static_assert(ToyFragment::Header::size_words > kWord, "The layout needs a third ToyFragment header word");
+
+	static ToyFragment::Header::data_t read_word_(uint8_t const* header)
+	{
+		ToyFragment::Header::data_t word;
+		memcpy(&word, header + kWord * sizeof(word), sizeof(word));  // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+		return word;
+	}
+
+	static void write_word_(uint8_t* header, ToyFragment::Header::data_t word)
+	{
+		memcpy(header + kWord * sizeof(word), &word, sizeof(word));  // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+	}
+
+	size_t channels_;
+	size_t samples_;
+	Order order_;
+};
+}  // namespace demo
+
+#endif /* artdaq_demo_Generators_ToyHardwareInterface_ToyChannelLayout_hh */
@@ -8,11 +8,29 @@
 #include "fhiclcpp/ParameterSet.h"
 
 #include <unistd.h>
+#include <algorithm>
 #include <cstdlib>
+#include <cmath>
+#include <cstring>
+#include <fstream>
 #include <iostream>
+#include <sstream>
 #include <random>
 #include <thread>
 
+namespace {
+// Tell the CPU we're in a spin-wait loop (saves power and frees resources
+// for a hyperthread sibling)
+inline void cpu_relax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#elif defined(__aarch64__)
+	asm volatile("yield");
+#endif
+}
+}  // namespace
+
 // JCF, Mar-17-2016
 
 // ToyHardwareInterface is meant to mimic a vendor-provided hardware
@@ -32,12 +50,49 @@ ToyHardwareInterface::ToyHardwareInterface(fhicl::ParameterSet const& ps)
     , maxADCvalue_(static_cast<size_t>(pow(2, NumADCBits()) - 1))  // MUST be after "fragment_type"
     , distribution_type_(static_cast<DistributionType>(ps.get<int>("distribution_type")))
     , configured_rates_()
+    , override_rates_()
+    , rates_(&configured_rates_)
     , engine_(ps.get<int64_t>("random_seed", 314159))
     , uniform_distn_(new std::uniform_int_distribution<demo::ToyFragment::adc_t>(0, maxADCvalue_))
-    , gaussian_distn_(new std::normal_distribution<double>(0.5 * maxADCvalue_, 0.1 * maxADCvalue_))
+    , gaussian_table_(nullptr)
+    , sparse_model_(nullptr)
+    , waveform_model_(nullptr)
+    , random_seed_(ps.get<int64_t>("random_seed", 314159))
+    , random_mode_(RandomMode::stream)
+    , readout_count_(0)
+    , adc_generator_(nullptr)
+    , readout_memory_(ps)
+    , fill_pool_(nullptr)
+    , fill_chunk_adcs_(ps.get<size_t>("fill_chunk_adcs", 262144))
+    , channels_(ps.get<size_t>("channels", 1))
+    , channel_order_(demo::ToyChannelLayout::Order::channel_major)
+    , ring_fragment_id_(0)
+    , ring_running_(false)
+    , ring_triggers_(0)
+    , ring_overflows_(0)
+    , ring_busy_time_(0)
+    , ring_full_(false)
+    , ring_full_since_(fake_time_)
+    , hit_rate_hz_(ps.get<double>("streaming_hit_rate_hz", 1000000.0))
+    , hit_clock_hz_(ps.get<double>("streaming_clock_hz", 1000000000.0))
+    , hit_channels_(ps.get<uint16_t>("streaming_channels", 64))
+    , stream_period_(ps.get<size_t>("streaming_period_us", 100))
+    , hits_written_(0)
+    , stream_clock_(0)
+    , last_overwritten_tick_(0)
+    , stream_running_(false)
     , start_time_(fake_time_)
     , rate_start_time_(fake_time_)
     , rate_send_calls_(0)
+    , next_trigger_(fake_time_)
+    , last_trigger_wait_(0)
+    , last_trigger_lateness_(0)
+    , spin_threshold_(ps.get<int64_t>("spin_threshold_ns", 50000))
+    , trigger_engine_(ps.get<int64_t>("random_seed", 314159))
+    , size_engine_(ps.get<int64_t>("random_seed", 314159))
+    , next_size_bytes_(0)
+    , in_burst_(false)
+    , burst_state_end_(fake_time_)
     , serial_number_((*uniform_distn_)(engine_))
 {
 	bool planned_disruption = exception_after_N_seconds_ || exit_after_N_seconds_ || abort_after_N_seconds_;
@@ -61,6 +116,7 @@ ToyHardwareInterface::ToyHardwareInterface(fhicl::ParameterSet const& ps)
 
 		RateInfo before;
 		before.size_bytes = counts1 * sizeof(demo::ToyFragment::Header::data_t) + sizeof(demo::ToyFragment::Header);
+		before.size_max = before.size_bytes;
 		before.rate_hz = rate;
 		before.duration = change_after_N_seconds_ != std::numeric_limits<size_t>::max()
 		                      ? std::chrono::microseconds(1000000 * change_after_N_seconds_)
@@ -71,6 +127,7 @@ ToyHardwareInterface::ToyHardwareInterface(fhicl::ParameterSet const& ps)
 		{
 			RateInfo after;
 			after.size_bytes = counts2 * sizeof(demo::ToyFragment::Header::data_t) + sizeof(demo::ToyFragment::Header);
+			after.size_max = after.size_bytes;
 			after.rate_hz = rate;
 			after.duration = std::chrono::microseconds(1000000 * change_after_N_seconds_);
 			configured_rates_.push_back(after);
@@ -84,21 +141,236 @@ ToyHardwareInterface::ToyHardwareInterface(fhicl::ParameterSet const& ps)
 		for (auto& pps : fhicl_rates)
 		{
 			RateInfo this_rate;
-			this_rate.size_bytes = pps.get<size_t>("size_bytes");
+			parse_size_distribution_(pps, this_rate);
 			this_rate.rate_hz = pps.get<size_t>("rate_hz");
 			this_rate.duration = std::chrono::microseconds(pps.get<size_t>("duration_us", 1000000));
+
+			auto model = pps.get<std::string>("trigger_model", "periodic");
+			if (model == "poisson")
+			{
+				this_rate.model = TriggerModel::poisson;
+			}
+			else if (model == "burst")
+			{
+				this_rate.model = TriggerModel::burst;
+				this_rate.burst_rate_hz = pps.get<double>("burst_rate_hz", 10.0 * this_rate.rate_hz);
+				this_rate.mean_quiet = std::chrono::microseconds(pps.get<size_t>("mean_quiet_us", 1000000));
+				this_rate.mean_burst = std::chrono::microseconds(pps.get<size_t>("mean_burst_us", 100000));
+				if (this_rate.mean_quiet.count() == 0 || this_rate.mean_burst.count() == 0)
+				{
+					throw cet::exception("HardwareInterface") << "rate_table entry with trigger_model \"burst\" must have non-zero \"mean_quiet_us\" and \"mean_burst_us\"";  // NOLINT(cert-err60-cpp)
+				}
+			}
+			else if (model == "spill")
+			{
+				this_rate.model = TriggerModel::spill;
+				this_rate.spill_on = std::chrono::microseconds(pps.get<size_t>("spill_on_us", 1000000));
+				this_rate.spill_off = std::chrono::microseconds(pps.get<size_t>("spill_off_us", 1000000));
+				if (this_rate.spill_on.count() == 0)
+				{
+					throw cet::exception("HardwareInterface") << "rate_table entry with trigger_model \"spill\" must have a non-zero \"spill_on_us\"";  // NOLINT(cert-err60-cpp)
+				}
+			}
+			else if (model != "periodic")
+			{
+				throw cet::exception("HardwareInterface") << "Unknown trigger_model \"" << model << "\" in rate_table; expected \"periodic\", \"poisson\", \"burst\" or \"spill\"";  // NOLINT(cert-err60-cpp)
+			}
+
+			if (this_rate.model != TriggerModel::periodic && (this_rate.rate_hz == 0 || (this_rate.model == TriggerModel::burst && this_rate.burst_rate_hz <= 0)))
+			{
+				throw cet::exception("HardwareInterface") << "rate_table entry with trigger_model \"" << model << "\" must have non-zero rates";  // NOLINT(cert-err60-cpp)
+			}
 			configured_rates_.push_back(this_rate);
 		}
 	}
 
+	switch (distribution_type_)
+	{
+		case DistributionType::uniform:
+			adc_generator_ = &ToyHardwareInterface::generate_adcs_<DistributionType::uniform>;
+			break;
+		case DistributionType::gaussian:
+			gaussian_table_.reset(new demo::GaussianAliasTable(0.5 * maxADCvalue_, 0.1 * maxADCvalue_, maxADCvalue_));
+			adc_generator_ = &ToyHardwareInterface::generate_adcs_<DistributionType::gaussian>;
+			break;
+		case DistributionType::monotonic:
+			adc_generator_ = &ToyHardwareInterface::generate_adcs_<DistributionType::monotonic>;
+			break;
+		case DistributionType::sparse:
+		{
+			auto occupancy = ps.get<double>("sparse_occupancy", 0.01);
+			auto noise_bits = ps.get<int>("sparse_noise_bits", 3);
+			auto target_ratio = ps.get<double>("target_compression_ratio", 0.0);
+			if (target_ratio > 0.0)
+			{
+				// Quiet samples carry noise_bits of entropy, pulse samples about a
+				// full ADC word; pick the noise that brings the 16-bit samples down to
+				// the requested ratio
+				noise_bits = static_cast<int>(std::lround(8.0 * sizeof(demo::ToyFragment::adc_t) / target_ratio - occupancy * NumADCBits()));
+				TLOG(TLVL_INFO) << "Using " << noise_bits << " bits of noise for a target compression ratio of " << target_ratio;
+			}
+			noise_bits = std::min(std::max(noise_bits, 0), NumADCBits());
+			sparse_model_.reset(new demo::SparsePulseModel(ps.get<size_t>("sparse_baseline", maxADCvalue_ / 8), noise_bits, occupancy,
+			                                               ps.get<size_t>("sparse_pulse_length", 16), maxADCvalue_));
+			adc_generator_ = &ToyHardwareInterface::generate_adcs_<DistributionType::sparse>;
+			break;
+		}
+		case DistributionType::waveform:
+		{
+			auto spectrum_name = ps.get<std::string>("waveform_amplitude_spectrum", "exponential");
+			auto spectrum = demo::WaveformModel::Spectrum::exponential;
+			if (spectrum_name == "flat")
+			{
+				spectrum = demo::WaveformModel::Spectrum::flat;
+			}
+			else if (spectrum_name == "power_law")
+			{
+				spectrum = demo::WaveformModel::Spectrum::power_law;
+			}
+			else if (spectrum_name != "exponential")
+			{
+				throw cet::exception("HardwareInterface") << "Unknown waveform_amplitude_spectrum \"" << spectrum_name << "\"; expected \"exponential\", \"flat\" or \"power_law\"";  // NOLINT(cert-err60-cpp)
+			}
+			auto index = ps.get<double>("waveform_power_law_index", 2.5);
+			if (spectrum == demo::WaveformModel::Spectrum::power_law && index <= 1.0)
+			{
+				throw cet::exception("HardwareInterface") << "\"waveform_power_law_index\" must be greater than 1";  // NOLINT(cert-err60-cpp)
+			}
+
+			auto sample_ns = ps.get<double>("waveform_sample_ns", 16.0);
+			waveform_model_.reset(new demo::WaveformModel(ps.get<double>("waveform_pedestal", maxADCvalue_ / 10.0),
+			                                              ps.get<double>("waveform_noise_rms", 2.0),
+			                                              ps.get<double>("waveform_noise_correlation", 4.0),
+			                                              ps.get<double>("waveform_pulse_rate_hz", 100000.0) * sample_ns * 1e-9,
+			                                              spectrum,
+			                                              ps.get<double>("waveform_amplitude", maxADCvalue_ / 20.0),
+			                                              index,
+			                                              ps.get<double>("waveform_shaping_ns", 64.0) / sample_ns,
+			                                              ps.get<int>("waveform_shaping_order", 2),
+			                                              maxADCvalue_));
+			adc_generator_ = &ToyHardwareInterface::generate_adcs_<DistributionType::waveform>;
+			break;
+		}
+		case DistributionType::hits:
+		{
+			// No ADC values; the hits are written by stream_loop_ and read out with ReadWindow
+			auto ring_hits = ps.get<size_t>("streaming_buffer_hits", 1048576);
+			if (ring_hits == 0 || hit_channels_ == 0 || hit_rate_hz_ <= 0.0 || hit_clock_hz_ <= 0.0)
+			{
+				throw cet::exception("HardwareInterface") << "The \"hits\" distribution needs non-zero \"streaming_buffer_hits\", "  // NOLINT(cert-err60-cpp)
+				                                             "\"streaming_channels\", \"streaming_hit_rate_hz\" and \"streaming_clock_hz\"";
+			}
+			TLOG(TLVL_INFO) << "Will stream " << hit_rate_hz_ << " hits/s on " << hit_channels_ << " channels into a ring of " << ring_hits << " hits";
+			hit_ring_.resize(ring_hits);
+			break;
+		}
+		case DistributionType::uninitialized:
+		case DistributionType::uninit2:
+			break;
+		default:
+			throw cet::exception("HardwareInterface") << "Unknown distribution type specified";  // NOLINT(cert-err60-cpp)
+	}
+
+	auto random_mode = ps.get<std::string>("random_mode", "stream");
+	if (random_mode == "counter")
+	{
+		random_mode_ = RandomMode::counter;
+	}
+	else if (random_mode != "stream")
+	{
+		throw cet::exception("HardwareInterface") << "Unknown random_mode \"" << random_mode << "\" specified; expected \"stream\" or \"counter\"";  // NOLINT(cert-err60-cpp)
+	}
+
+	auto channel_layout = ps.get<std::string>("channel_layout", "channel_major");
+	if (channel_layout == "interleaved")
+	{
+		channel_order_ = demo::ToyChannelLayout::Order::interleaved;
+	}
+	else if (channel_layout != "channel_major")
+	{
+		throw cet::exception("HardwareInterface") << "Unknown channel_layout \"" << channel_layout << "\" specified; expected \"channel_major\" or \"interleaved\"";  // NOLINT(cert-err60-cpp)
+	}
+	if (channels_ == 0 || channels_ > demo::ToyChannelLayout::kMaxChannels)
+	{
+		throw cet::exception("HardwareInterface") << "\"channels\" must be between 1 and " << demo::ToyChannelLayout::kMaxChannels;  // NOLINT(cert-err60-cpp)
+	}
+
+	auto pattern_bank_size = ps.get<size_t>("pattern_bank_size", 0);
+	if (pattern_bank_size > 0)
+	{
+		if (adc_generator_ == nullptr)
+		{
+			throw cet::exception("HardwareInterface") << "\"pattern_bank_size\" requires a distribution_type which generates data";  // NOLINT(cert-err60-cpp)
+		}
+		if (distribution_type_ == DistributionType::monotonic && pattern_bank_size > 1)
+		{
+			throw cet::exception("HardwareInterface") << "The monotonic distribution makes the same payload every time, so \"pattern_bank_size\" "  // NOLINT(cert-err60-cpp)
+			                                             "cannot be more than 1 with it";
+		}
+
+		// Each pattern covers the largest readout in the rate_table (including
+		// the padding to a whole data_t word); smaller readouts use a prefix
+		auto nADCs = maxADCcounts_() * sizeof(demo::ToyFragment::Header::data_t) / sizeof(demo::ToyFragment::adc_t);
+		TLOG(TLVL_INFO) << "Pregenerating " << pattern_bank_size << " patterns of " << nADCs << " ADC values";
+		pattern_bank_.resize(pattern_bank_size);
+		for (size_t ii = 0; ii < pattern_bank_size; ++ii)
+		{
+			pattern_bank_[ii].resize(nADCs);
+			(this->*adc_generator_)(pattern_bank_[ii].data(), 0, nADCs, ReadoutKey{ii, ii, 0});
+		}
+		adc_generator_ = &ToyHardwareInterface::copy_pattern_;
+	}
+
+	auto fill_threads = ps.get<size_t>("fill_threads", 1);
+	if (fill_chunk_adcs_ == 0)
+	{
+		throw cet::exception("HardwareInterface") << "\"fill_chunk_adcs\" must be greater than zero";  // NOLINT(cert-err60-cpp)
+	}
+	if (fill_threads > 1 && adc_generator_ != nullptr)
+	{
+		TLOG(TLVL_INFO) << "Will fill readout buffers using " << fill_threads << " threads, " << fill_chunk_adcs_ << " ADC values at a time";
+		fill_pool_.reset(new demo::FillWorkerPool(fill_threads, [this] { readout_memory_.BindThread(); }));
+	}
+
+	auto ring_buffers = ps.get<size_t>("readout_ring_buffers", 0);
+	if (ring_buffers > 0 && StreamingEnabled())
+	{
+		throw cet::exception("HardwareInterface") << "\"readout_ring_buffers\" cannot be used with the streaming (\"hits\") readout, which has a ring of its own";  // NOLINT(cert-err60-cpp)
+	}
+	if (ring_buffers > 0)
+	{
+		auto fragment_ids = ps.get<std::vector<int>>("fragment_ids", std::vector<int>());
+		ring_fragment_id_ = ps.get<int>("fragment_id", fragment_ids.empty() ? 0 : fragment_ids.front());
+
+		TLOG(TLVL_INFO) << "Will fill a ring of " << ring_buffers << " readout buffers asynchronously";
+		ring_buffers_.resize(ring_buffers);
+		for (auto& buffer : ring_buffers_)
+		{
+			AllocateReadoutBuffer(&buffer);
+		}
+	}
+
 	bool first = true;
 	for (auto& rate : configured_rates_)
 	{
-		TLOG(TLVL_INFO) << (first ? "W" : ", then w") << "ill generate " << rate.size_bytes << " B Fragments at " << rate.rate_hz << " Hz for " << rate.duration.count() << " us";
+		TLOG(TLVL_INFO) << (first ? "W" : ", then w") << "ill generate " << rate.size_bytes << " B Fragments at " << rate.rate_hz << " Hz"
+		                << (rate.size_distribution == SizeDistribution::fixed ? "" : " (variable size, up to " + std::to_string(rate.size_max) + " B)")
+		                << (rate.model == TriggerModel::poisson ? " (Poisson)" : rate.model == TriggerModel::burst ? " (bursts)" : rate.model == TriggerModel::spill ? " (in spills)" : "")
+		                << " for " << rate.duration.count() << " us";
 		first = false;
 	}
 
 	current_rate_ = configured_rates_.begin();
+	next_size_bytes_ = draw_readout_size_();
+}
+
+ToyHardwareInterface::~ToyHardwareInterface()
+{
+	StopDatataking();
+	for (auto& buffer : ring_buffers_)
+	{
+		readout_memory_.Free(buffer);
+	}
 }
 
 // JCF, Mar-18-2017
@@ -111,149 +383,745 @@ void ToyHardwareInterface::StartDatataking()
 {
 	taking_data_ = true;
 	rate_send_calls_ = 0;
-	current_rate_ = configured_rates_.begin();
+	readout_count_ = 0;
+	rates_ = &configured_rates_;
+	current_rate_ = rates_->begin();
+	trigger_engine_.seed(random_seed_);  // Every run draws the same trigger times...
+	size_engine_.seed(random_seed_);     // ...and readout sizes
 	start_time_ = std::chrono::steady_clock::now();
-	rate_start_time_ = start_time_;
+	begin_rate_entry_(start_time_);
+
+	if (ReadoutRingEnabled())
+	{
+		// All buffers are expected to have been returned by the consumer by now
+		{
+			std::unique_lock<std::mutex> lk(ring_mutex_);
+			ring_free_ = ring_buffers_;
+			ring_filled_.clear();
+			ring_exception_ = nullptr;
+			ring_triggers_ = 0;
+			ring_overflows_ = 0;
+			ring_busy_time_ = std::chrono::steady_clock::duration::zero();
+			ring_full_ = false;
+			ring_running_ = true;
+		}
+		ring_thread_ = std::thread(&ToyHardwareInterface::ring_loop_, this);
+	}
+
+	if (StreamingEnabled())
+	{
+		{
+			std::unique_lock<std::mutex> lk(stream_mutex_);
+			hits_written_ = 0;
+			stream_clock_ = 0;
+			last_overwritten_tick_ = 0;
+			stream_running_ = true;
+		}
+		stream_thread_ = std::thread(&ToyHardwareInterface::stream_loop_, this);
+	}
 }
 
 void ToyHardwareInterface::StopDatataking()
 {
+	if (ring_thread_.joinable())
+	{
+		{
+			std::unique_lock<std::mutex> lk(ring_mutex_);
+			ring_running_ = false;
+		}
+		ring_stop_cv_.notify_all();
+		ring_thread_.join();
+	}
+	if (stream_thread_.joinable())
+	{
+		{
+			std::unique_lock<std::mutex> lk(stream_mutex_);
+			stream_running_ = false;
+		}
+		stream_stop_cv_.notify_all();
+		stream_thread_.join();
+	}
+
 	taking_data_ = false;
 	start_time_ = fake_time_;
 	rate_start_time_ = fake_time_;
+	next_trigger_ = fake_time_;
 }
 
 void ToyHardwareInterface::FillBuffer(char* buffer, size_t* bytes_read)
+{
+	FillBuffer(buffer, bytes_read, readout_count_, 0);
+}
+
+void ToyHardwareInterface::FillBuffer(char* buffer, size_t* bytes_read, uint64_t sequence_id, uint16_t fragment_id)
+{
+	FillBuffers(&buffer, 1, bytes_read, sequence_id, &fragment_id);
+}
+
+void ToyHardwareInterface::FillBuffers(char* const* buffers, size_t nbuffers, size_t* bytes_read, uint64_t sequence_id, uint16_t const* fragment_ids)
+{
+	TLOG(TLVL_TRACE) << "FillBuffer BEGIN";
+	*bytes_read = take_trigger_();
+	TLOG(TLVL_DEBUG + 3) << "FillBuffer: Setting bytes_read to " << *bytes_read;
+	fill_readouts_(
+	    buffers, nbuffers, [&](size_t) { return *bytes_read; },
+	    [&](size_t ii) {
+		    return ReadoutKey{readout_count_, sequence_id, fragment_ids[ii]};  // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+	    });
+	++readout_count_;
+	advance_trigger_();
+	TLOG(TLVL_TRACE) << "FillBuffer END";
+}
+
+void ToyHardwareInterface::FillBuffers(char* const* buffers, size_t nbuffers, double const* size_scales, size_t* bytes_read, uint64_t sequence_id, uint16_t const* fragment_ids)
 {
 	TLOG(TLVL_TRACE) << "FillBuffer BEGIN";
-	if (taking_data_)
+	if (PatternBankEnabled() && std::any_of(size_scales, size_scales + nbuffers, [](double scale) { return scale > 1.0; }))  // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
 	{
-		auto elapsed_secs_since_datataking_start = artdaq::TimeUtils::GetElapsedTime(start_time_);
-		if (elapsed_secs_since_datataking_start < 0) elapsed_secs_since_datataking_start = 0;
+		throw cet::exception("ToyHardwareInterface") << "A buffer can't be larger than the readout with a pattern bank, whose patterns only cover the largest readout";  // NOLINT(cert-err60-cpp)
+	}
+	*bytes_read = take_trigger_();
+	TLOG(TLVL_DEBUG + 3) << "FillBuffer: Readout of " << *bytes_read << " bytes, scaled per buffer";
+	fill_readouts_(
+	    buffers, nbuffers, [&](size_t ii) { return scaled_size_bytes_(*bytes_read, size_scales[ii]); },  // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+	    [&](size_t ii) {
+		    return ReadoutKey{readout_count_, sequence_id, fragment_ids[ii]};  // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+	    });
+	++readout_count_;
+	advance_trigger_();
+	TLOG(TLVL_TRACE) << "FillBuffer END";
+}
 
-		if (static_cast<size_t>(elapsed_secs_since_datataking_start) >= change_after_N_seconds_)
+// Wait for the next trigger and return the size of its readout; the caller
+// fills the buffers, then counts the readout and moves on to the next trigger
+size_t ToyHardwareInterface::take_trigger_()
+{
+	if (StreamingEnabled())
+	{
+		throw cet::exception("ToyHardwareInterface") << "FillBuffer cannot be used with the streaming (\"hits\") readout; use ReadWindow";  // NOLINT(cert-err60-cpp)
+	}
+	if (!taking_data_)
+	{
+		throw cet::exception("ToyHardwareInterface") << "Attempt to call FillBuffer when not sending data";  // NOLINT(cert-err60-cpp)
+	}
+
+	auto wait_begin = std::chrono::steady_clock::now();
+	last_trigger_lateness_ = std::max(wait_begin - next_trigger_, std::chrono::steady_clock::duration::zero());
+	wait_for_trigger_();
+	last_trigger_wait_ = std::chrono::steady_clock::now() - wait_begin;
+	apply_engineered_disruptions_();
+
+	auto bytes_read = ReadoutSizeBytes();
+	readout_sizes_.Record(bytes_read);
+	return bytes_read;
+}
+
+void ToyHardwareInterface::FillBatch(char* const* buffers, size_t ntriggers, size_t nfragments, size_t* bytes_read, uint64_t const* sequence_ids, uint16_t const* fragment_ids)
+{
+	TLOG(TLVL_TRACE) << "FillBatch BEGIN";
+	if (ReadoutSizeVaries())
+	{
+		throw cet::exception("ToyHardwareInterface") << "FillBatch fills every trigger at the same size, so it cannot be used with a rate_table size_distribution";  // NOLINT(cert-err60-cpp)
+	}
+	if (!taking_data_)
+	{
+		throw cet::exception("ToyHardwareInterface") << "Attempt to call FillBatch when not sending data";  // NOLINT(cert-err60-cpp)
+	}
+	if (StreamingEnabled())
+	{
+		throw cet::exception("ToyHardwareInterface") << "FillBatch cannot be used with the streaming (\"hits\") readout; use ReadWindow";  // NOLINT(cert-err60-cpp)
+	}
+
+	// Take every trigger of the batch first (those already due cost nothing),
+	// then generate all of their data in a single pass, so that the fill
+	// pool sees the whole batch at once
+	*bytes_read = ReadoutSizeBytes();
+	auto first_readout = readout_count_;
+	auto wait_begin = std::chrono::steady_clock::now();
+	last_trigger_lateness_ = std::max(wait_begin - next_trigger_, std::chrono::steady_clock::duration::zero());
+	for (size_t tt = 0; tt < ntriggers; ++tt)
+	{
+		wait_for_trigger_();
+		apply_engineered_disruptions_();
+		readout_sizes_.Record(*bytes_read);
+		++readout_count_;
+		advance_trigger_();
+	}
+	last_trigger_wait_ = std::chrono::steady_clock::now() - wait_begin;
+
+	TLOG(TLVL_DEBUG + 3) << "FillBatch: Filling " << ntriggers << " readouts of " << nfragments << " buffers each";
+	fill_readouts_(
+	    buffers, ntriggers * nfragments, [&](size_t) { return *bytes_read; },
+	    [&](size_t ii) {
+		    auto trigger = ii / nfragments;
+		    return ReadoutKey{first_readout + trigger, sequence_ids[trigger], fragment_ids[ii % nfragments]};  // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+	    });
+
+	TLOG(TLVL_TRACE) << "FillBatch END";
+}
+
+void ToyHardwareInterface::apply_engineered_disruptions_()
+{
+	auto elapsed_secs_since_datataking_start = artdaq::TimeUtils::GetElapsedTime(start_time_);
+	if (elapsed_secs_since_datataking_start < 0) elapsed_secs_since_datataking_start = 0;
+
+	if (static_cast<size_t>(elapsed_secs_since_datataking_start) >= change_after_N_seconds_)
+	{
+		if (abort_after_N_seconds_)
 		{
-			if (abort_after_N_seconds_)
-			{
-				TLOG(TLVL_ERROR) << "Engineered Abort!";
-				std::abort();
-			}
-			else if (exit_after_N_seconds_)
+			TLOG(TLVL_ERROR) << "Engineered Abort!";
+			std::abort();
+		}
+		else if (exit_after_N_seconds_)
+		{
+			TLOG(TLVL_ERROR) << "Engineered Exit!";
+			std::exit(1);
+		}
+		else if (exception_after_N_seconds_)
+		{
+			TLOG(TLVL_ERROR) << "Engineered Exception!";
+			throw cet::exception("HardwareInterface")  // NOLINT(cert-err60-cpp)
+			    << "This is an engineered exception designed for testing purposes";
+		}
+		else if (hang_after_N_seconds_)
+		{
+			TLOG(TLVL_ERROR) << "Pretending that the hardware has hung! Variable name for gdb: hardwareIsHung";
+			volatile bool hardwareIsHung = true;
+			// Pretend the hardware hangs
+			while (hardwareIsHung)
 			{
-				TLOG(TLVL_ERROR) << "Engineered Exit!";
-				std::exit(1);
+				usleep(10000);
 			}
-			else if (exception_after_N_seconds_)
+		}
+
+		if ((pause_after_N_seconds_ != 0u) && (static_cast<size_t>(elapsed_secs_since_datataking_start) % change_after_N_seconds_ == 0))
+		{
+			TLOG(TLVL_DEBUG + 3) << "pausing " << pause_after_N_seconds_ << " seconds";
+			sleep(pause_after_N_seconds_);
+			TLOG(TLVL_DEBUG + 3) << "resuming after pause of " << pause_after_N_seconds_ << " seconds";
+		}
+	}
+}
+
+// Sleeping is only accurate to the scheduler's granularity (tens of
+// microseconds at best), so the last stretch before a trigger is spent
+// spinning on the clock instead
+
+void ToyHardwareInterface::wait_for_trigger_()
+{
+	if (next_trigger_ - std::chrono::steady_clock::now() > spin_threshold_)
+	{
+		std::this_thread::sleep_until(next_trigger_ - spin_threshold_);
+	}
+	while (std::chrono::steady_clock::now() < next_trigger_)
+	{
+		cpu_relax();
+	}
+}
+
+size_t ToyHardwareInterface::PendingTriggers() const
+{
+	if (ReadoutRingEnabled())
+	{
+		std::unique_lock<std::mutex> lk(ring_mutex_);
+		return ring_filled_.size();
+	}
+
+	auto now = std::chrono::steady_clock::now();
+	if (!taking_data_ || next_trigger_ > now)
+	{
+		return 0;
+	}
+	if (current_rate_->rate_hz == 0 || current_rate_->model != TriggerModel::periodic)
+	{
+		// Random arrival times are only drawn one at a time; callers re-query
+		// after each readout, so a backlog still drains completely
+		return 1;
+	}
+
+	// Count the triggers of the current rate_table entry which are due by now
+	auto segment_end = std::min(now, rate_start_time_ + current_rate_->duration);
+	auto due = static_cast<uint64_t>(std::chrono::duration<double>(segment_end - rate_start_time_).count() * current_rate_->rate_hz);
+	return due >= rate_send_calls_ ? due - rate_send_calls_ + 1 : 1;
+}
+
+// The readout ring thread plays the part of the hardware: on every trigger
+// it grabs a free buffer and fills it, whether or not the consumer is
+// keeping up. A trigger which finds no free buffer is lost, as it would be
+// on a real board whose DMA ring is full.
+
+void ToyHardwareInterface::ring_loop_()
+{
+	readout_memory_.BindThread();
+	try
+	{
+		std::unique_lock<std::mutex> lk(ring_mutex_);
+		while (ring_running_)
+		{
+			// Sleep interruptibly, then spin for the last stretch as wait_for_trigger_ does
+			if (ring_stop_cv_.wait_until(lk, next_trigger_ - spin_threshold_, [this] { return !ring_running_; }))
 			{
-				TLOG(TLVL_ERROR) << "Engineered Exception!";
-				throw cet::exception("HardwareInterface")  // NOLINT(cert-err60-cpp)
-				    << "This is an engineered exception designed for testing purposes";
+				break;
 			}
-			else if (hang_after_N_seconds_)
+			lk.unlock();
+			wait_for_trigger_();
+			lk.lock();
+
+			char* buffer = nullptr;
+			++ring_triggers_;
+			if (!ring_free_.empty())
 			{
-				TLOG(TLVL_ERROR) << "Pretending that the hardware has hung! Variable name for gdb: hardwareIsHung";
-				volatile bool hardwareIsHung = true;
-				// Pretend the hardware hangs
-				while (hardwareIsHung)
+				buffer = ring_free_.back();
+				ring_free_.pop_back();
+				if (ring_free_.empty())
 				{
-					usleep(10000);
+					ring_full_ = true;
+					ring_full_since_ = std::chrono::steady_clock::now();
 				}
 			}
+			else
+			{
+				++ring_overflows_;
+				TLOG(TLVL_DEBUG + 5) << "Readout ring full, trigger " << readout_count_ << " lost";
+			}
+			lk.unlock();
 
-			if ((pause_after_N_seconds_ != 0u) && (static_cast<size_t>(elapsed_secs_since_datataking_start) % change_after_N_seconds_ == 0))
+			apply_engineered_disruptions_();
+
+			auto trigger_number = readout_count_++;
+			if (buffer != nullptr)
 			{
-				TLOG(TLVL_DEBUG + 3) << "pausing " << pause_after_N_seconds_ << " seconds";
-				sleep(pause_after_N_seconds_);
-				TLOG(TLVL_DEBUG + 3) << "resuming after pause of " << pause_after_N_seconds_ << " seconds";
+				auto bytes_read = ReadoutSizeBytes();
+				readout_sizes_.Record(bytes_read);
+				fill_readouts_(
+				    &buffer, 1, [&](size_t) { return bytes_read; }, [&](size_t) { return ReadoutKey{trigger_number, trigger_number, ring_fragment_id_}; });
+
+				lk.lock();
+				ring_filled_.push_back({buffer, bytes_read});
+				lk.unlock();
+				ring_filled_cv_.notify_one();
 			}
+
+			advance_trigger_();
+			lk.lock();
 		}
+	}
+	catch (...)
+	{
+		TLOG(TLVL_ERROR) << "Readout ring thread caught an exception, it will be rethrown to the consumer";
+		std::unique_lock<std::mutex> lk(ring_mutex_);
+		ring_exception_ = std::current_exception();
+		ring_filled_cv_.notify_all();
+	}
+}
 
-		TLOG(TLVL_DEBUG + 3) << "FillBuffer: Setting bytes_read to " << sizeof(demo::ToyFragment::Header) + bytes_to_nWords_(current_rate_->size_bytes) * sizeof(demo::ToyFragment::Header::data_t);
-		*bytes_read = sizeof(demo::ToyFragment::Header) + bytes_to_nWords_(current_rate_->size_bytes) * sizeof(demo::ToyFragment::Header::data_t);
-		TLOG(TLVL_DEBUG + 3) << "FillBuffer: Making the fake data, starting with the header";
+std::chrono::steady_clock::duration ToyHardwareInterface::LastTriggerWait() const { return last_trigger_wait_; }
 
-		// Can't handle a fragment whose size isn't evenly divisible by
-		// the demo::ToyFragment::Header::data_t type size in bytes
-		// std::cout << "Bytes to read: " << *bytes_read << ", sizeof(demo::ToyFragment::Header::data_t): " <<
-		// sizeof(demo::ToyFragment::Header::data_t) << std::endl;
-		assert(*bytes_read % sizeof(demo::ToyFragment::Header::data_t) == 0);
+std::chrono::steady_clock::duration ToyHardwareInterface::LastTriggerLateness() const { return last_trigger_lateness_; }
+
+void ToyHardwareInterface::SetRate(size_t size_bytes, size_t rate_hz)
+{
+	if (ReadoutRingEnabled() || StreamingEnabled())
+	{
+		throw cet::exception("HardwareInterface") << "SetRate cannot be used with the readout ring or the streaming readout";  // NOLINT(cert-err60-cpp)
+	}
+	if (!FitsReadoutBuffers(size_bytes))
+	{
+		throw cet::exception("HardwareInterface") << "SetRate: " << size_bytes << " B readouts would not fit the readout buffers, "  // NOLINT(cert-err60-cpp)
+		                                             "which are sized for the largest size in the rate_table";
+	}
 
-		auto* header = reinterpret_cast<demo::ToyFragment::Header*>(buffer);  // NOLINT(cppcoreguidelines-pro-type-reinterpret-cast)
+	RateInfo rate;
+	rate.size_bytes = size_bytes;
+	rate.size_max = size_bytes;
+	rate.rate_hz = rate_hz;
+	rate.duration = std::chrono::microseconds(1000000);
+	override_rates_.assign(1, rate);
+	rates_ = &override_rates_;
+	current_rate_ = rates_->begin();
+	begin_rate_entry_(taking_data_ ? std::chrono::steady_clock::now() : fake_time_);
+	TLOG(TLVL_DEBUG + 3) << "SetRate: Now generating " << size_bytes << " B Fragments at " << rate_hz << " Hz";
+}
 
-		header->event_size = *bytes_read / sizeof(demo::ToyFragment::Header::data_t);
-		header->trigger_number = 99;
-		header->distribution_type = static_cast<uint8_t>(distribution_type_);
+void ToyHardwareInterface::WarmUp(char* buffer)
+{
+	auto bytes = sizeof(demo::ToyFragment::Header) + maxADCcounts_() * sizeof(demo::ToyFragment::Header::data_t);
+	for (auto& ring_buffer : ring_buffers_)
+	{
+		demo::ReadoutMemory::Prefault(ring_buffer, bytes);
+	}
+
+	char* scratch = buffer;
+	if (scratch == nullptr)
+	{
+		AllocateReadoutBuffer(&scratch);
+	}
+	demo::ReadoutMemory::Prefault(scratch, bytes);
+	fill_readouts_(
+	    &scratch, 1, [&](size_t) { return bytes; }, [](size_t) { return ReadoutKey{0, 0, 0}; });
+	if (buffer == nullptr)
+	{
+		FreeReadoutBuffer(scratch);
+	}
+}
 
-		TLOG(TLVL_DEBUG + 3) << "FillBuffer: Generating nADCcounts ADC values ranging from 0 to max based on the desired distribution";
+void ToyHardwareInterface::BindReadoutThread() const { readout_memory_.BindThread(); }
 
-		std::function<demo::ToyFragment::adc_t()> generator;
-		demo::ToyFragment::adc_t gen_seed = 0;
+bool ToyHardwareInterface::ReadoutRingEnabled() const { return !ring_buffers_.empty(); }
 
-		switch (distribution_type_)
-		{
-			case DistributionType::uniform:
-				generator = [&]() { return static_cast<demo::ToyFragment::adc_t>((*uniform_distn_)(engine_)); };
-				break;
+bool ToyHardwareInterface::PatternBankEnabled() const { return !pattern_bank_.empty(); }
 
-			case DistributionType::gaussian:
-				generator = [&]() {
-					do
-					{
-						gen_seed = static_cast<demo::ToyFragment::adc_t>(std::round((*gaussian_distn_)(engine_)));
-					} while (gen_seed > maxADCvalue_);
-					return gen_seed;
-				};
-				break;
+bool ToyHardwareInterface::ReadoutSizeVaries() const
+{
+	return std::any_of(configured_rates_.begin(), configured_rates_.end(), [](RateInfo const& rate) { return rate.size_distribution != SizeDistribution::fixed; });
+}
+
+bool ToyHardwareInterface::FitsReadoutBuffers(size_t size_bytes) const { return bytes_to_nWords_(size_bytes) <= maxADCcounts_(); }
+
+bool ToyHardwareInterface::WaitForReadout(char** buffer, size_t* bytes_read, size_t timeout_us)
+{
+	std::unique_lock<std::mutex> lk(ring_mutex_);
+	ring_filled_cv_.wait_for(lk, std::chrono::microseconds(timeout_us), [this] { return !ring_filled_.empty() || ring_exception_; });
+
+	if (ring_exception_)
+	{
+		std::rethrow_exception(ring_exception_);
+	}
+	if (ring_filled_.empty())
+	{
+		return false;
+	}
+
+	*buffer = ring_filled_.front().buffer;
+	*bytes_read = ring_filled_.front().bytes_read;
+	ring_filled_.pop_front();
+	return true;
+}
+
+ToyHardwareInterface::ReadoutRingStatistics ToyHardwareInterface::GetReadoutRingStatistics() const
+{
+	std::unique_lock<std::mutex> lk(ring_mutex_);
+	auto busy = ring_busy_time_;
+	if (ring_full_)
+	{
+		busy += std::chrono::steady_clock::now() - ring_full_since_;
+	}
+	return ReadoutRingStatistics{ring_triggers_, ring_overflows_, std::chrono::duration<double>(busy).count(), ring_filled_.size(), ring_buffers_.size()};
+}
+
+// The streaming thread plays the part of a trigger-less front end: hits
+// arrive at random (Poisson) times and are written into the ring as soon
+// as the clock passes them, overwriting the oldest ones. It catches up
+// with the clock every stream_period_, so stream_clock_ always marks how
+// far the ring is known to be complete.
+
+void ToyHardwareInterface::stream_loop_()
+{
+	static_assert(sizeof(HitRecord) == 3 * sizeof(demo::ToyFragment::Header::data_t), "HitRecord must be a whole number of ToyFragment data words");
+
+	readout_memory_.BindThread();
 
-			case DistributionType::monotonic: {
-				generator = [&]() {
-					if (++gen_seed > maxADCvalue_)
-					{
-						gen_seed = 0;
-					}
-					return gen_seed;
-				};
+	std::mt19937_64 engine(random_seed_);
+	std::exponential_distribution<double> gap_ticks(hit_rate_hz_ / hit_clock_hz_);
+	std::uniform_int_distribution<uint16_t> channel(0, hit_channels_ - 1);
+	std::uniform_int_distribution<uint16_t> adc(0, maxADCvalue_);
+	double next_hit = gap_ticks(engine);
+
+	std::unique_lock<std::mutex> lk(stream_mutex_);
+	while (stream_running_)
+	{
+		auto now = static_cast<uint64_t>(std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time_).count() * hit_clock_hz_);
+		while (next_hit <= now)
+		{
+			auto& slot = hit_ring_[hits_written_ % hit_ring_.size()];
+			if (hits_written_ >= hit_ring_.size())
+			{
+				last_overwritten_tick_ = slot.Timestamp();
 			}
-			break;
+			auto tick = static_cast<uint64_t>(next_hit);
+			slot.timestamp_low = static_cast<uint32_t>(tick);
+			slot.timestamp_high = static_cast<uint32_t>(tick >> 32);
+			slot.channel = channel(engine);
+			slot.adc = adc(engine);
+			++hits_written_;
+			next_hit += gap_ticks(engine);
+		}
+		stream_clock_ = now;
 
-			case DistributionType::uninitialized:
-			case DistributionType::uninit2:
-				break;
+		stream_stop_cv_.wait_for(lk, stream_period_, [this] { return !stream_running_; });
+	}
+}
+
+bool ToyHardwareInterface::StreamingEnabled() const { return distribution_type_ == DistributionType::hits; }
+
+ToyHardwareInterface::WindowStatus ToyHardwareInterface::ReadWindow(uint64_t begin, uint64_t end, std::function<char*(size_t)> const& allocate, size_t* bytes_read)
+{
+	if (!StreamingEnabled())
+	{
+		throw cet::exception("ToyHardwareInterface") << "ReadWindow requires the streaming (\"hits\") readout";  // NOLINT(cert-err60-cpp)
+	}
 
-			default:
-				throw cet::exception("HardwareInterface") << "Unknown distribution type specified";  // NOLINT(cert-err60-cpp)
+	std::unique_lock<std::mutex> lk(stream_mutex_);
+	if (end > stream_clock_)
+	{
+		return WindowStatus::pending;
+	}
+
+	// Hits are written in time order, so the ring (read from its oldest hit,
+	// by logical index) is sorted and the window's edges can be bisected
+	auto ring_size = hit_ring_.size();
+	auto first = hits_written_ - std::min<uint64_t>(hits_written_, ring_size);
+	auto lower_bound = [&](uint64_t tick) {
+		auto lo = first;
+		auto hi = hits_written_;
+		while (lo < hi)
+		{
+			auto mid = lo + (hi - lo) / 2;
+			if (hit_ring_[mid % ring_size].Timestamp() < tick)
+			{
+				lo = mid + 1;
+			}
+			else
+			{
+				hi = mid;
+			}
 		}
+		return lo;
+	};
+	auto window_begin = lower_bound(begin);
+	auto nhits = lower_bound(std::max(begin, end)) - window_begin;
+
+	// Don't hold up the writer thread while the buffer is allocated; the
+	// window's hits can't change, but the oldest of them may be overwritten
+	// in the meantime, in which case only the rest are read out
+	lk.unlock();
+	auto* buffer = allocate(sizeof(demo::ToyFragment::Header) + nhits * sizeof(HitRecord));
+	lk.lock();
+	auto oldest = hits_written_ - std::min<uint64_t>(hits_written_, ring_size);
+	auto lost = oldest > window_begin ? std::min<uint64_t>(oldest - window_begin, nhits) : 0;
+	window_begin += lost;
+	nhits -= lost;
+
+	*bytes_read = sizeof(demo::ToyFragment::Header) + nhits * sizeof(HitRecord);
+	auto* header = reinterpret_cast<demo::ToyFragment::Header*>(buffer);  // NOLINT(cppcoreguidelines-pro-type-reinterpret-cast)
+	header->event_size = *bytes_read / sizeof(demo::ToyFragment::Header::data_t);
+	header->trigger_number = 99;
+	header->distribution_type = static_cast<uint8_t>(distribution_type_);
+	demo::ToyChannelLayout::Erase(header);
+
+	// At most two copies, either side of the ring's wrap-around point
+	auto* hits = reinterpret_cast<HitRecord*>(header + 1);  // NOLINT(cppcoreguidelines-pro-type-reinterpret-cast)
+	auto slot = window_begin % ring_size;
+	auto head = std::min<uint64_t>(nhits, ring_size - slot);
+	memcpy(hits, &hit_ring_[slot], head * sizeof(HitRecord));
+	memcpy(hits + head, hit_ring_.data(), (nhits - head) * sizeof(HitRecord));  // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+
+	return lost > 0 || (hits_written_ > ring_size && last_overwritten_tick_ >= begin) ? WindowStatus::partial : WindowStatus::complete;
+}
+
+ToyHardwareInterface::StreamingStatistics ToyHardwareInterface::GetStreamingStatistics() const
+{
+	std::unique_lock<std::mutex> lk(stream_mutex_);
+	StreamingStatistics stats{stream_clock_, hit_clock_hz_, hits_written_, std::min<size_t>(hits_written_, hit_ring_.size()), 0.0};
+	if (stats.hits_buffered > 0)
+	{
+		auto oldest = hit_ring_[(hits_written_ - stats.hits_buffered) % hit_ring_.size()].Timestamp();
+		stats.depth_seconds = (stream_clock_ - oldest) / hit_clock_hz_;
+	}
+	return stats;
+}
+
+void ToyHardwareInterface::RegenerateBuffer(char* buffer, size_t bytes_read, uint64_t sequence_id, uint16_t fragment_id)
+{
+	if (random_mode_ != RandomMode::counter)
+	{
+		throw cet::exception("ToyHardwareInterface") << "RegenerateBuffer requires random_mode \"counter\"";  // NOLINT(cert-err60-cpp)
+	}
+	fill_readouts_(
+	    &buffer, 1, [&](size_t) { return bytes_read; }, [&](size_t) { return ReadoutKey{0, sequence_id, fragment_id}; });
+}
+
+template<class SIZE_OF, class KEY_OF>
+void ToyHardwareInterface::fill_readouts_(char* const* buffers, size_t nbuffers, SIZE_OF const& size_of, KEY_OF const& key_of)
+{
+	TLOG(TLVL_DEBUG + 3) << "FillBuffer: Making the fake data, starting with the header";
+
+	buffer_adcs_.resize(nbuffers);
+	size_t max_adcs = 0;
+	for (size_t ii = 0; ii < nbuffers; ++ii)
+	{
+		auto bytes_read = size_of(ii);
 
-		if (distribution_type_ != DistributionType::uninitialized && distribution_type_ != DistributionType::uninit2)
+		// Can't handle a fragment whose size isn't evenly divisible by
+		// the demo::ToyFragment::Header::data_t type size in bytes
+		assert(bytes_read % sizeof(demo::ToyFragment::Header::data_t) == 0);
+
+		auto* header = reinterpret_cast<demo::ToyFragment::Header*>(buffers[ii]);  // NOLINT(cppcoreguidelines-pro-type-reinterpret-cast,cppcoreguidelines-pro-bounds-pointer-arithmetic)
+
+		header->event_size = bytes_read / sizeof(demo::ToyFragment::Header::data_t);
+		header->trigger_number = pattern_bank_.empty() ? 99 : static_cast<uint32_t>(key_of(ii).sequence_id);
+		header->distribution_type = static_cast<uint8_t>(distribution_type_);
+		demo::ToyChannelLayout::Write(header, channels_, channel_order_);
+
+		buffer_adcs_[ii] = bytes_to_nADCs_(bytes_read);
+		max_adcs = std::max(max_adcs, buffer_adcs_[ii]);
+	}
+
+	if (adc_generator_ == nullptr || nbuffers == 0)
+	{
+		return;
+	}
+
+	// Generate every ADC covered by the readout (including the padding to
+	// a whole data_t word), so that each buffer is fully determined by its key.
+	// The data are generated channel-major; interleaved readouts go through
+	// a scratch buffer and are transposed into place afterwards
+	TLOG(TLVL_DEBUG + 3) << "FillBuffer: Generating nADCcounts ADC values ranging from 0 to max based on the desired distribution";
+	auto interleave = channel_order_ == demo::ToyChannelLayout::Order::interleaved && channels_ > 1;
+	if (interleave)
+	{
+		if (interleave_scratch_.size() < nbuffers)
 		{
-			TLOG(TLVL_DEBUG + 3) << "FillBuffer: Calling generate_n";
-			std::generate_n(reinterpret_cast<demo::ToyFragment::adc_t*>(reinterpret_cast<demo::ToyFragment::Header*>(buffer) + 1),  // NOLINT(cppcoreguidelines-pro-type-reinterpret-cast,cppcoreguidelines-pro-bounds-pointer-arithmetic)
-			                bytes_to_nADCs_(current_rate_->size_bytes), generator);
+			interleave_scratch_.resize(nbuffers);
 		}
+		for (size_t ii = 0; ii < nbuffers; ++ii)
+		{
+			if (interleave_scratch_[ii].size() < buffer_adcs_[ii])
+			{
+				interleave_scratch_[ii].resize(buffer_adcs_[ii]);
+			}
+		}
+	}
+	auto adcs = [&](size_t buffer) {
+		if (interleave)
+		{
+			return interleave_scratch_[buffer].data();
+		}
+		return reinterpret_cast<demo::ToyFragment::adc_t*>(reinterpret_cast<demo::ToyFragment::Header*>(buffers[buffer]) + 1);  // NOLINT(cppcoreguidelines-pro-type-reinterpret-cast,cppcoreguidelines-pro-bounds-pointer-arithmetic)
+	};
+
+	if (fill_pool_ && (nbuffers > 1 || max_adcs > fill_chunk_adcs_))
+	{
+		// Every sample depends only on its buffer's key and its index, so the
+		// result is the same however the buffers are split between threads.
+		// Buffers smaller than the largest leave their last chunks idle
+		auto chunks_per_buffer = std::max<size_t>(1, (max_adcs + fill_chunk_adcs_ - 1) / fill_chunk_adcs_);
+		fill_pool_->Run(nbuffers * chunks_per_buffer, [&](size_t chunk) {
+			auto buffer = chunk / chunks_per_buffer;
+			auto begin = (chunk % chunks_per_buffer) * fill_chunk_adcs_;
+			if (begin < buffer_adcs_[buffer])
+			{
+				(this->*adc_generator_)(adcs(buffer), begin, std::min(begin + fill_chunk_adcs_, buffer_adcs_[buffer]), key_of(buffer));
+			}
+		});
 	}
 	else
 	{
-		throw cet::exception("ToyHardwareInterface") << "Attempt to call FillBuffer when not sending data";  // NOLINT(cert-err60-cpp)
+		for (size_t ii = 0; ii < nbuffers; ++ii)
+		{
+			(this->*adc_generator_)(adcs(ii), 0, buffer_adcs_[ii], key_of(ii));
+		}
 	}
 
-	auto now = std::chrono::steady_clock::now();
-	auto next = next_trigger_time_();
+	if (interleave)
+	{
+		interleave_channels_(buffers, nbuffers);
+	}
+}
+
+// A task interleaves a run of samples of every channel, and writes one
+// contiguous stretch of the buffer; within it, the transpose goes a block
+// of samples at a time, so that the block being written stays in cache
+
+void ToyHardwareInterface::interleave_channels_(char* const* buffers, size_t nbuffers)
+{
+	constexpr size_t kBlockSamples = 64;
+	auto max_samples = *std::max_element(buffer_adcs_.begin(), buffer_adcs_.begin() + nbuffers) / channels_;
+	auto task_samples = std::max<size_t>(kBlockSamples, fill_chunk_adcs_ / channels_);
+	auto tasks_per_buffer = std::max<size_t>(1, (max_samples + task_samples - 1) / task_samples);
+
+	auto interleave = [&](size_t task) {
+		auto buffer = task / tasks_per_buffer;
+		auto nADCs = buffer_adcs_[buffer];
+		auto samples = nADCs / channels_;
+		auto begin = (task % tasks_per_buffer) * task_samples;
+		auto end = std::min(begin + task_samples, samples);
+		auto const* in = interleave_scratch_[buffer].data();
+		auto* out = reinterpret_cast<demo::ToyFragment::adc_t*>(reinterpret_cast<demo::ToyFragment::Header*>(buffers[buffer]) + 1);  // NOLINT(cppcoreguidelines-pro-type-reinterpret-cast,cppcoreguidelines-pro-bounds-pointer-arithmetic)
+		for (auto block = begin; block < end; block += kBlockSamples)
+		{
+			auto block_end = std::min(block + kBlockSamples, end);
+			for (size_t channel = 0; channel < channels_; ++channel)
+			{
+				auto const* from = in + channel * samples;  // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+				for (auto sample = block; sample < block_end; ++sample)
+				{
+					out[sample * channels_ + channel] = from[sample];  // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+				}
+			}
+		}
+		if (begin == 0)
+		{
+			// The padding belongs to no channel, and stays where it is
+			std::copy(in + channels_ * samples, in + nADCs, out + channels_ * samples);  // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+		}
+	};
 
-	if (next > now)
+	if (fill_pool_ && nbuffers * tasks_per_buffer > 1)
 	{
-		std::this_thread::sleep_until(next_trigger_time_());
+		fill_pool_->Run(nbuffers * tasks_per_buffer, interleave);
 	}
-	++rate_send_calls_;
-	TLOG(TLVL_TRACE) << "FillBuffer END";
+	else
+	{
+		for (size_t task = 0; task < nbuffers * tasks_per_buffer; ++task)
+		{
+			interleave(task);
+		}
+	}
+}
+
+size_t ToyHardwareInterface::ReadoutSizeBytes() const
+{
+	return sizeof(demo::ToyFragment::Header) + bytes_to_nWords_(next_size_bytes_) * sizeof(demo::ToyFragment::Header::data_t);
+}
+
+size_t ToyHardwareInterface::ReadoutSizeBytes(double size_scale) const { return scaled_size_bytes_(ReadoutSizeBytes(), size_scale); }
+
+size_t ToyHardwareInterface::FirstReadoutMaxBytes() const
+{
+	return sizeof(demo::ToyFragment::Header) + bytes_to_nWords_(configured_rates_.front().size_max) * sizeof(demo::ToyFragment::Header::data_t);
+}
+
+size_t ToyHardwareInterface::scaled_size_bytes_(size_t bytes, double size_scale) const
+{
+	auto nWords = std::llround(bytes_to_nWords_(bytes) * std::max(size_scale, 0.0));
+	return sizeof(demo::ToyFragment::Header) + static_cast<size_t>(nWords) * sizeof(demo::ToyFragment::Header::data_t);
 }
 
+demo::SizeHistogram::Summary ToyHardwareInterface::TakeReadoutSizeStatistics() { return readout_sizes_.TakeSummary(); }
+
 void ToyHardwareInterface::AllocateReadoutBuffer(char** buffer)
 {
-	*buffer = reinterpret_cast<char*>(  // NOLINT(cppcoreguidelines-pro-type-reinterpret-cast)
-	    new uint8_t[sizeof(demo::ToyFragment::Header) + maxADCcounts_() * sizeof(demo::ToyFragment::Header::data_t)]);
+	*buffer = readout_memory_.Allocate(sizeof(demo::ToyFragment::Header) + maxADCcounts_() * sizeof(demo::ToyFragment::Header::data_t));
 }
 
-void ToyHardwareInterface::FreeReadoutBuffer(const char* buffer) { delete[] buffer; }
+void ToyHardwareInterface::FreeReadoutBuffer(const char* buffer)
+{
+	auto ring_buffer = std::find(ring_buffers_.begin(), ring_buffers_.end(), buffer);
+	if (ring_buffer == ring_buffers_.end())
+	{
+		readout_memory_.Free(buffer);
+		return;
+	}
+
+	std::unique_lock<std::mutex> lk(ring_mutex_);
+	if (ring_full_)
+	{
+		ring_busy_time_ += std::chrono::steady_clock::now() - ring_full_since_;
+		ring_full_ = false;
+	}
+	ring_free_.push_back(*ring_buffer);
+}
 
 int ToyHardwareInterface::BoardType() const
 {
@@ -263,38 +1131,278 @@ int ToyHardwareInterface::BoardType() const
 	return static_cast<int>(fragment_type_) + 1000;
 }
 
-std::chrono::microseconds ToyHardwareInterface::rate_to_delay_(std::size_t hz) { return std::chrono::microseconds(static_cast<int>(1000000.0 / hz)); }
+template<ToyHardwareInterface::DistributionType DIST>
+void ToyHardwareInterface::generate_adcs_(demo::ToyFragment::adc_t* adcs, size_t begin, size_t end, ReadoutKey const& key) const
+{
+	if (random_mode_ == RandomMode::counter)
+	{
+		run_kernel_<DIST>(adcs, begin, end, demo::PhiloxStream(random_seed_, key.sequence_id, key.fragment_id));
+	}
+	else
+	{
+		auto board_key = demo::SplitMixStream{random_seed_}(key.fragment_id);
+		run_kernel_<DIST>(adcs, begin, end, demo::SplitMixStream{demo::SplitMixStream{board_key}(key.readout_number)});
+	}
+}
+
+void ToyHardwareInterface::copy_pattern_(demo::ToyFragment::adc_t* adcs, size_t begin, size_t end, ReadoutKey const& key) const
+{
+	auto event = random_mode_ == RandomMode::counter ? key.sequence_id : key.readout_number;
+	auto const& pattern = pattern_bank_[(event + key.fragment_id) % pattern_bank_.size()];
+	std::copy(pattern.begin() + begin, pattern.begin() + end, adcs + begin);  // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+}
+
+template<ToyHardwareInterface::DistributionType DIST, class STREAM>
+void ToyHardwareInterface::run_kernel_(demo::ToyFragment::adc_t* adcs, size_t begin, size_t end, STREAM const& stream) const
+{
+	// Resolved at compile time, so each instantiation is a direct call into
+	// one (vectorized) kernel with no per-sample dispatch
+	if constexpr (DIST == DistributionType::uniform)
+	{
+		demo::GenerateUniformADCs(adcs, begin, end, stream, maxADCvalue_);
+	}
+	else if constexpr (DIST == DistributionType::gaussian)
+	{
+		demo::GenerateGaussianADCs(adcs, begin, end, stream, *gaussian_table_);
+	}
+	else if constexpr (DIST == DistributionType::monotonic)
+	{
+		demo::GenerateMonotonicADCs(adcs, begin, end, maxADCvalue_);
+	}
+	else if constexpr (DIST == DistributionType::sparse)
+	{
+		demo::GenerateSparseADCs(adcs, begin, end, stream, *sparse_model_);
+	}
+	else if constexpr (DIST == DistributionType::waveform)
+	{
+		demo::GenerateWaveformADCs(adcs, begin, end, stream, *waveform_model_);
+	}
+}
+
+// Trigger times are computed from the start of the rate_table entry with
+// integer nanosecond arithmetic, so rounding never accumulates
+
+std::chrono::nanoseconds ToyHardwareInterface::trigger_offset_(RateInfo const& rate, uint64_t trigger) const
+{
+	// Split into whole and fractional seconds so the product can't overflow
+	auto seconds = trigger / rate.rate_hz;
+	auto remainder = trigger % rate.rate_hz;
+	return std::chrono::nanoseconds(static_cast<int64_t>(seconds * 1000000000 + remainder * 1000000000 / rate.rate_hz));
+}
+
+void ToyHardwareInterface::advance_trigger_()
+{
+	++rate_send_calls_;
+	time_type next_time;
+	if (current_rate_->model != TriggerModel::periodic)
+	{
+		next_time = draw_trigger_after_(next_trigger_);
+	}
+	else if (current_rate_->rate_hz != 0)
+	{
+		next_time = rate_start_time_ + trigger_offset_(*current_rate_, rate_send_calls_);
+	}
+	else
+	{
+		next_time = std::max(next_trigger_, std::chrono::steady_clock::now());
+	}
+
+	auto entry_end = rate_start_time_ + current_rate_->duration;
+	if (next_time > entry_end)
+	{
+		// A periodic entry hands its overrunning trigger to the next entry, as
+		// it always has; a random one simply ends on time
+		auto next_start = current_rate_->model == TriggerModel::periodic ? next_time : entry_end;
+		if (++current_rate_ == rates_->end()) current_rate_ = rates_->begin();
+		begin_rate_entry_(next_start);
+		return;
+	}
+	next_trigger_ = next_time;
+	next_size_bytes_ = draw_readout_size_();
+}
+
+void ToyHardwareInterface::begin_rate_entry_(time_type start)
+{
+	rate_start_time_ = start;
+	rate_send_calls_ = 0;
+	if (current_rate_->model == TriggerModel::burst)
+	{
+		in_burst_ = false;
+		burst_state_end_ = start + draw_exponential_(std::chrono::duration<double>(current_rate_->mean_quiet).count());
+	}
+	next_trigger_ = current_rate_->model == TriggerModel::periodic ? start : draw_trigger_after_(start);
+	next_size_bytes_ = draw_readout_size_();
+}
+
+// All of the random models are (piecewise) Poisson processes, which are
+// memoryless: the next arrival after any instant can be drawn afresh from
+// that instant. A state change (end of a burst, end of a spill) therefore
+// simply restarts the draw from the moment of the change.
 
-std::chrono::steady_clock::time_point ToyHardwareInterface::next_trigger_time_()
+ToyHardwareInterface::time_type ToyHardwareInterface::draw_trigger_after_(time_type from)
 {
-	auto next_time = rate_start_time_ + (rate_send_calls_ + 1) * rate_to_delay_(current_rate_->rate_hz);
-	if (next_time > rate_start_time_ + current_rate_->duration)
+	auto const& rate = *current_rate_;
+	auto time = from;
+	switch (rate.model)
 	{
-		if (++current_rate_ == configured_rates_.end()) current_rate_ = configured_rates_.begin();
-		rate_send_calls_ = 0;
-		rate_start_time_ = next_time;
+		case TriggerModel::burst:
+			while (true)
+			{
+				auto next_time = time + draw_exponential_(1.0 / (in_burst_ ? rate.burst_rate_hz : rate.rate_hz));
+				if (next_time < burst_state_end_)
+				{
+					return next_time;
+				}
+				time = burst_state_end_;
+				in_burst_ = !in_burst_;
+				burst_state_end_ = time + draw_exponential_(std::chrono::duration<double>(in_burst_ ? rate.mean_burst : rate.mean_quiet).count());
+			}
+		case TriggerModel::spill:
+			while (true)
+			{
+				auto cycle = std::chrono::duration_cast<std::chrono::nanoseconds>(rate.spill_on + rate.spill_off);
+				auto phase = (time - rate_start_time_) % cycle;
+				if (phase >= rate.spill_on)
+				{
+					// Beam off: skip to the start of the next spill
+					time += cycle - phase;
+					phase = std::chrono::nanoseconds(0);
+				}
+				auto next_time = time + draw_exponential_(1.0 / rate.rate_hz);
+				if (next_time - time < rate.spill_on - phase)
+				{
+					return next_time;
+				}
+				time += rate.spill_on - phase;
+			}
+		case TriggerModel::poisson:
+		default:
+			return time + draw_exponential_(1.0 / rate.rate_hz);
+	}
+}
+
+std::chrono::nanoseconds ToyHardwareInterface::draw_exponential_(double mean_seconds)
+{
+	std::exponential_distribution<double> gap(1.0 / mean_seconds);
+	return std::chrono::nanoseconds(static_cast<int64_t>(gap(trigger_engine_) * 1e9));
+}
+
+void ToyHardwareInterface::parse_size_distribution_(fhicl::ParameterSet const& pps, RateInfo& rate)
+{
+	auto distribution = pps.get<std::string>("size_distribution", "fixed");
+	if (distribution == "fixed")
+	{
+		rate.size_bytes = pps.get<size_t>("size_bytes");
+		rate.size_max = rate.size_bytes;
+		return;
+	}
+
+	if (distribution == "histogram")
+	{
+		auto file_name = pps.get<std::string>("size_histogram_file");
+		std::ifstream file(file_name);
+		if (!file)
+		{
+			throw cet::exception("HardwareInterface") << "Cannot open size_histogram_file \"" << file_name << "\"";  // NOLINT(cert-err60-cpp)
+		}
+		std::vector<double> weights;
+		std::string line;
+		while (std::getline(file, line))
+		{
+			std::istringstream fields(line);
+			size_t size = 0;
+			double weight = 0;
+			if (line.empty() || line[0] == '#')
+			{
+				continue;
+			}
+			if (!(fields >> size >> weight) || weight < 0)
+			{
+				throw cet::exception("HardwareInterface") << "Bad line in size_histogram_file \"" << file_name << "\": \"" << line  // NOLINT(cert-err60-cpp)
+				                                          << "\"; expected \"<size in bytes> <weight>\"";
+			}
+			rate.histogram_sizes.push_back(size);
+			weights.push_back(weight);
+		}
+		if (weights.empty() || std::all_of(weights.begin(), weights.end(), [](double weight) { return weight == 0; }))
+		{
+			throw cet::exception("HardwareInterface") << "size_histogram_file \"" << file_name << "\" has no entries with a non-zero weight";  // NOLINT(cert-err60-cpp)
+		}
+		rate.size_distribution = SizeDistribution::histogram;
+		rate.histogram = std::discrete_distribution<size_t>(weights.begin(), weights.end());
+		rate.size_bytes = pps.get<size_t>("size_bytes", 0);
+		rate.size_max = pps.get<size_t>("size_max_bytes", *std::max_element(rate.histogram_sizes.begin(), rate.histogram_sizes.end()));
+	}
+	else
+	{
+		if (distribution == "lognormal")
+		{
+			rate.size_distribution = SizeDistribution::lognormal;
+			rate.size_sigma = pps.get<double>("size_sigma", 0.5);
+		}
+		else if (distribution == "exponential")
+		{
+			rate.size_distribution = SizeDistribution::exponential;
+		}
+		else
+		{
+			throw cet::exception("HardwareInterface") << "Unknown size_distribution \"" << distribution << "\" in rate_table; expected \"fixed\", \"lognormal\", \"exponential\" or \"histogram\"";  // NOLINT(cert-err60-cpp)
+		}
+		rate.size_bytes = pps.get<size_t>("size_bytes");
+		rate.size_max = pps.get<size_t>("size_max_bytes", 10 * rate.size_bytes);
+		if (rate.size_bytes == 0)
+		{
+			throw cet::exception("HardwareInterface") << "rate_table entry with size_distribution \"" << distribution << "\" must have a non-zero size_bytes";  // NOLINT(cert-err60-cpp)
+		}
+	}
+
+	rate.size_min = pps.get<size_t>("size_min_bytes", 0);
+	if (rate.size_min > rate.size_max)
+	{
+		throw cet::exception("HardwareInterface") << "rate_table entry has size_min_bytes " << rate.size_min << " above size_max_bytes " << rate.size_max;  // NOLINT(cert-err60-cpp)
+	}
+}
+
+size_t ToyHardwareInterface::draw_readout_size_()
+{
+	auto& rate = *current_rate_;
+	double size = 0;
+	switch (rate.size_distribution)
+	{
+		case SizeDistribution::fixed:
+			return rate.size_bytes;
+		case SizeDistribution::lognormal:
+			size = std::lognormal_distribution<double>(std::log(static_cast<double>(rate.size_bytes)), rate.size_sigma)(size_engine_);
+			break;
+		case SizeDistribution::exponential:
+			size = std::exponential_distribution<double>(1.0 / rate.size_bytes)(size_engine_);
+			break;
+		case SizeDistribution::histogram:
+			size = static_cast<double>(rate.histogram_sizes[rate.histogram(size_engine_)]);
+			break;
 	}
-	return next_time;
+	size = std::min(std::max(size, static_cast<double>(rate.size_min)), static_cast<double>(rate.size_max));
+	return static_cast<size_t>(std::llround(size));
 }
 
-size_t ToyHardwareInterface::bytes_to_nWords_(size_t bytes)
+size_t ToyHardwareInterface::bytes_to_nWords_(size_t bytes) const
 {
 	if (bytes < sizeof(demo::ToyFragment::Header)) return 0;
 	return ceil((bytes - sizeof(demo::ToyFragment::Header)) / static_cast<double>(sizeof(demo::ToyFragment::Header::data_t)));
 }
 
-size_t ToyHardwareInterface::bytes_to_nADCs_(size_t bytes)
+size_t ToyHardwareInterface::bytes_to_nADCs_(size_t bytes) const
 {
 	if (bytes < sizeof(demo::ToyFragment::Header)) return 0;
 	return ceil((bytes - sizeof(demo::ToyFragment::Header)) / static_cast<double>(sizeof(demo::ToyFragment::adc_t)));
 }
 
-size_t ToyHardwareInterface::maxADCcounts_()
+size_t ToyHardwareInterface::maxADCcounts_() const
 {
 	size_t max_bytes = 0;
 	for (auto& rate : configured_rates_)
 	{
-		if (rate.size_bytes > max_bytes) max_bytes = rate.size_bytes;
+		if (rate.size_max > max_bytes) max_bytes = rate.size_max;
 	}
 	return bytes_to_nWords_(max_bytes);
 }
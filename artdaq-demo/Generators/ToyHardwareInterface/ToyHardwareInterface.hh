@@ -3,11 +3,22 @@
 
 #include "artdaq-core-demo/Overlays/FragmentType.hh"
 #include "artdaq-core-demo/Overlays/ToyFragment.hh"
+#include "artdaq-demo/Generators/ToyHardwareInterface/ADCGenerationKernels.hh"
+#include "artdaq-demo/Generators/ToyHardwareInterface/FillWorkerPool.hh"
+#include "artdaq-demo/Generators/ToyHardwareInterface/ReadoutMemory.hh"
+#include "artdaq-demo/Generators/ToyHardwareInterface/SizeHistogram.hh"
+#include "artdaq-demo/Generators/ToyHardwareInterface/ToyChannelLayout.hh"
 
 #include "fhiclcpp/fwd.h"
 
 #include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
 #include <random>
+#include <thread>
 
 /**
  * \brief JCF, Mar-17-2016: ToyHardwareInterface is meant to mimic a vendor-provided hardware
@@ -25,9 +36,104 @@ public:
 	/**
 	 * \brief Construct and configure ToyHardwareInterface
 	 * \param ps fhicl::ParameterSet with configuration options for ToyHardwareInterface
+	 *
+	 * \verbatim
+	 * Besides the rate_table (or nADCcounts/throttle_usecs) and the engineered-failure parameters, ToyHardwareInterface accepts:
+	 * "random_seed" (Default: 314159): Seed for the generated data; a given seed always produces the same data
+	 * "fill_threads" (Default: 1): Number of threads used to fill a single readout buffer. The output does not
+	 *   depend on this setting.
+	 * "fill_chunk_adcs" (Default: 262144): Number of ADC values handed to a fill thread at a time
+	 * "random_mode" (Default: "stream"): "stream" derives each readout's random numbers from the seed and the
+	 *   number of readouts so far. "counter" uses a Philox counter-based generator keyed on
+	 *   (random_seed, sequence ID, fragment ID, sample index), so that any event can be regenerated
+	 *   independently with RegenerateBuffer.
+	 * In both modes, each fragment ID passed to FillBuffer(s) gets its own random stream.
+	 * "pattern_bank_size" (Default: 0): If non-zero, this many payloads of the configured distribution are
+	 *   generated at configuration time, and each readout copies one of them (chosen by readout number, or by
+	 *   sequence ID in "counter" random_mode, plus fragment ID) instead of generating new data. The header
+	 *   trigger_number is set to the low 32 bits of the sequence ID so that events remain distinguishable.
+	 *   The data are as valid as freshly generated ones, at memcpy speed. The monotonic distribution
+	 *   (distribution_type 2) makes the same payload every time, so it allows at most 1.
+	 * For the "sparse" distribution (distribution_type 5):
+	 *   "sparse_baseline" (Default: 1/8 of the ADC range): Baseline, in ADC counts
+	 *   "sparse_noise_bits" (Default: 3): Bits of uniform noise on every sample
+	 *   "sparse_occupancy" (Default: 0.01): Fraction of samples belonging to a pulse
+	 *   "sparse_pulse_length" (Default: 16): Length of a pulse, in samples
+	 *   "target_compression_ratio" (Default: 0): If non-zero, overrides sparse_noise_bits with the number of
+	 *     noise bits which gives (to first order, from the entropy per sample) this compression ratio
+	 * For the "waveform" distribution (distribution_type 6):
+	 *   "waveform_pedestal" (Default: 1/10 of the ADC range): Pedestal, in ADC counts
+	 *   "waveform_noise_rms" (Default: 2.0): RMS of the noise, in ADC counts
+	 *   "waveform_noise_correlation" (Default: 4.0): Correlation length of the noise, in samples
+	 *   "waveform_sample_ns" (Default: 16): Sampling period of the digitizer
+	 *   "waveform_pulse_rate_hz" (Default: 100000): Rate of pulses on the channel
+	 *   "waveform_amplitude_spectrum" (Default: "exponential"): "exponential" (mean waveform_amplitude),
+	 *     "flat" (up to the full ADC range) or "power_law" (index waveform_power_law_index, minimum
+	 *     waveform_amplitude)
+	 *   "waveform_amplitude" (Default: 1/20 of the ADC range): Amplitude scale of the spectrum, in ADC counts
+	 *   "waveform_power_law_index" (Default: 2.5): Index of the power law spectrum (must be greater than 1)
+	 *   "waveform_shaping_ns" (Default: 64): Time constant of the CR-RC^n shaper
+	 *   "waveform_shaping_order" (Default: 2): Order n of the CR-RC^n shaper
+	 * "channels" (Default: 1): Number of channels of the board. The ADC values of a readout are split evenly
+	 *   between them (any remainder is padding); each channel gets a contiguous stretch of the generated data, so
+	 *   that e.g. the noise of the "waveform" distribution is correlated along a channel.
+	 * "channel_layout" (Default: "channel_major"): Order of the channels' ADC values in the payload: "channel_major"
+	 *   (every sample of a channel, then the next channel) or "interleaved" (one sample of every channel, then the
+	 *   next sample). A channel's data are the same in both layouts. The layout is recorded in the ToyFragment header;
+	 *   see demo::ToyChannelLayout for the accessors. Not used by the "hits" distribution.
+	 * "readout_ring_buffers" (Default: 0): If non-zero, the simulated hardware runs asynchronously, like a DMA
+	 *   engine: a background thread fills a ring of this many preallocated readout buffers at the rate_table
+	 *   cadence, independently of the consumer, which picks them up with WaitForReadout. A trigger which
+	 *   arrives while every buffer is in use is lost and counted as an overflow. The ring data are
+	 *   keyed on the hardware trigger number (the sequence ID in "counter" random_mode) and on
+	 *   "fragment_id" (or the first of "fragment_ids").
+	 * For the "hits" distribution (distribution_type 7), the hardware is a trigger-less streaming readout: a
+	 *   background thread continuously writes timestamped hits into a bounded ring, and data are read out by
+	 *   time window with ReadWindow instead of FillBuffer. The rate_table is not used.
+	 *   "streaming_hit_rate_hz" (Default: 1000000): Mean rate of (Poisson) hits, over all channels
+	 *   "streaming_clock_hz" (Default: 1000000000): Frequency of the hit timestamp clock, which starts at 0 at StartDatataking
+	 *   "streaming_channels" (Default: 64): Number of channels the hits are spread over
+	 *   "streaming_buffer_hits" (Default: 1048576): Depth of the hit ring; older hits are overwritten
+	 *   "streaming_period_us" (Default: 100): How often the writer thread catches up with the clock
+	 * "readout_buffer_pages" (Default: "normal"), "readout_buffer_mlock" (Default: false), "numa_node" (Default: -1):
+	 *   Back the readout buffers with huge pages, lock them into RAM and bind them (and the readout threads) to a
+	 *   NUMA node; see demo::ReadoutMemory
+	 * "spin_threshold_ns" (Default: 50000): Triggers are paced with nanosecond precision; the pacing sleeps until
+	 *   this long before a trigger is due and busy-waits for the rest, trading some CPU for accuracy at high
+	 *   rates. 0 never spins. A rate_hz of 0 means "as fast as possible".
+	 * Each rate_table entry has "size_bytes", "rate_hz" and "duration_us" (Default: 1000000), and may select a
+	 * "trigger_model" (Default: "periodic"):
+	 *   "periodic": One trigger every 1/rate_hz
+	 *   "poisson": Exponentially distributed gaps with mean 1/rate_hz
+	 *   "burst": Poisson arrivals whose rate switches between rate_hz (quiet) and "burst_rate_hz" (Default:
+	 *     10 * rate_hz), with exponentially distributed quiet and burst periods of mean "mean_quiet_us"
+	 *     (Default: 1000000) and "mean_burst_us" (Default: 100000)
+	 *   "spill": Poisson arrivals at rate_hz during "spill_on_us" (Default: 1000000), followed by no triggers
+	 *     for "spill_off_us" (Default: 1000000), repeating
+	 *   The random models draw from their own generator, seeded with random_seed at the start of every run, so a
+	 *   given seed always produces the same sequence of trigger times.
+	 * The readout size of an entry may vary from event to event, with "size_distribution" (Default: "fixed"):
+	 *   "fixed": Every readout is size_bytes
+	 *   "lognormal": Log-normal sizes with median size_bytes and "size_sigma" (Default: 0.5), the standard
+	 *     deviation of the log of the size
+	 *   "exponential": Exponentially distributed sizes with mean size_bytes
+	 *   "histogram": Sizes drawn from an empirical histogram read from "size_histogram_file", a text file with
+	 *     one "<size in bytes> <weight>" pair per line (blank lines and lines starting with '#' are skipped);
+	 *     size_bytes is not used
+	 *   Sizes are clamped to ["size_min_bytes" (Default: 0), "size_max_bytes" (Default: 10 * size_bytes, or the
+	 *   largest size in the histogram)]; the readout buffers are sized for the largest size_max_bytes. Sizes are
+	 *   drawn from their own generator, seeded with random_seed at the start of every run, and each readout's size
+	 *   is drawn when the previous one is taken, so that ReadoutSizeBytes can tell it in advance. FillBatch, which
+	 *   fills a whole batch of triggers at one size, cannot be used with a size_distribution.
+	 * \endverbatim
 	 */
 	explicit ToyHardwareInterface(fhicl::ParameterSet const& ps);
 
+	/**
+	 * \brief Stop the readout ring thread, if any, and release the ring buffers
+	 */
+	~ToyHardwareInterface();
+
 	/**
 	 * \brief  "StartDatataking" is meant to mimic actions one would take when
 	 * telling the hardware to start sending data - the uploading of
@@ -47,6 +153,268 @@ public:
 	 */
 	void FillBuffer(char* buffer, size_t* bytes_read);
 
+	/**
+	 * \brief Use configured generator to fill a buffer with the data for the given event
+	 * \param buffer Buffer to fill
+	 * \param bytes_read Number of bytes to fill
+	 * \param sequence_id Sequence ID of the event (used as part of the random key in "counter" random_mode)
+	 * \param fragment_id Fragment ID of the data (used as part of the random key in "counter" random_mode)
+	 */
+	void FillBuffer(char* buffer, size_t* bytes_read, uint64_t sequence_id, uint16_t fragment_id);
+
+	/**
+	 * \brief Fill several buffers, one per fragment ID, from a single readout (i.e. a single trigger)
+	 * \param buffers Buffers to fill, each at least ReadoutSizeBytes() long
+	 * \param nbuffers Number of buffers
+	 * \param bytes_read Number of bytes written to each buffer
+	 * \param sequence_id Sequence ID of the event
+	 * \param fragment_ids Fragment ID of the data in each buffer; each gets its own random stream
+	 *
+	 * The buffers are filled concurrently when "fill_threads" is greater than 1.
+	 */
+	void FillBuffers(char* const* buffers, size_t nbuffers, size_t* bytes_read, uint64_t sequence_id, uint16_t const* fragment_ids);
+
+	/**
+	 * \brief Fill several buffers from a single readout, each with a payload size of its own
+	 * \param buffers Buffers to fill, buffer i at least ReadoutSizeBytes(size_scales[i]) long
+	 * \param nbuffers Number of buffers
+	 * \param size_scales Size of each buffer's payload, relative to the readout's (see ReadoutSizeBytes(double));
+	 * at most 1 with a pattern bank, whose patterns are only as long as the largest readout
+	 * \param bytes_read Size of the readout; buffer i gets ReadoutSizeBytes(size_scales[i]) bytes of it
+	 * \param sequence_id Sequence ID of the event
+	 * \param fragment_ids Fragment ID of the data in each buffer; each gets its own random stream
+	 *
+	 * For boards of one trigger which read out very different amounts of
+	 * data. Each buffer's data depend only on its fragment ID, the sequence
+	 * ID and its own size, as with FillBuffers.
+	 */
+	void FillBuffers(char* const* buffers, size_t nbuffers, double const* size_scales, size_t* bytes_read, uint64_t sequence_id, uint16_t const* fragment_ids);
+
+	/**
+	 * \brief Read out several triggers in one go, filling one buffer per trigger and fragment ID
+	 * \param buffers Buffers to fill, trigger-major (buffers[t * nfragments + f]), each at least ReadoutSizeBytes() long
+	 * \param ntriggers Number of triggers to read out
+	 * \param nfragments Number of fragment IDs per trigger
+	 * \param bytes_read Number of bytes written to each buffer (the readout size at the first trigger)
+	 * \param sequence_ids Sequence ID of each trigger's event
+	 * \param fragment_ids Fragment IDs, the same for every trigger
+	 *
+	 * Equivalent to ntriggers calls to FillBuffers, except that the data is
+	 * only generated once the last trigger is due, in a single pass over all
+	 * the buffers (spread over the fill threads when "fill_threads" is greater
+	 * than 1). Meant for serving a backlog of data requests at once.
+	 */
+	void FillBatch(char* const* buffers, size_t ntriggers, size_t nfragments, size_t* bytes_read, uint64_t const* sequence_ids, uint16_t const* fragment_ids);
+
+	/**
+	 * \brief Regenerate, bit for bit, the data FillBuffer produced for a given event. Requires "counter" random_mode.
+	 * \param buffer Buffer to fill
+	 * \param bytes_read Size of the original readout, as reported by FillBuffer
+	 * \param sequence_id Sequence ID of the event
+	 * \param fragment_id Fragment ID of the data
+	 *
+	 * This does not pace, does not advance the rate table and does not count
+	 * as a readout, so it may be called at any time, e.g. from a debugger or
+	 * an offline tool, to reproduce a single event of a run.
+	 */
+	void RegenerateBuffer(char* buffer, size_t bytes_read, uint64_t sequence_id, uint16_t fragment_id);
+
+	/**
+	 * \brief Get the number of bytes the next call to FillBuffer will write
+	 * \return Size of the next readout, in bytes
+	 *
+	 * This lets the caller hand FillBuffer memory it owns (e.g. the payload of
+	 * a freshly allocated artdaq::Fragment) instead of a buffer obtained from
+	 * AllocateReadoutBuffer.
+	 */
+	size_t ReadoutSizeBytes() const;
+
+	/**
+	 * \brief Get the number of bytes the next readout will write to a buffer whose payload is scaled
+	 * \param size_scale Size of the buffer's ADC payload, relative to the readout's (rounded to whole header words)
+	 * \return Size of the buffer's data, header included, in bytes
+	 */
+	size_t ReadoutSizeBytes(double size_scale) const;
+
+	/**
+	 * \brief Get the largest number of bytes a readout of the first rate_table entry, which runs start with, can write
+	 * \return ReadoutSizeBytes at the entry's largest size (its size_max_bytes with a size_distribution)
+	 */
+	size_t FirstReadoutMaxBytes() const;
+
+	/**
+	 * \brief Take the sizes of the readouts since the last call
+	 * \return Count, mean, median, 99th percentile and maximum of the readout sizes (all zero if there were none)
+	 *
+	 * With a size_distribution, this is what to size max_fragment_size_bytes
+	 * and the buffer_count of the shared memory against.
+	 */
+	demo::SizeHistogram::Summary TakeReadoutSizeStatistics();
+
+	/**
+	 * \brief Number of triggers which are already due, i.e. which FillBuffer would read out without waiting
+	 * \return Number of pending triggers (with the readout ring: number of filled buffers waiting for the consumer)
+	 *
+	 * When the consumer has fallen behind the trigger rate, this lets it read
+	 * out every trigger which has come due in one go.
+	 */
+	size_t PendingTriggers() const;
+
+	/**
+	 * \brief How long the last FillBuffer/FillBuffers call waited for its trigger
+	 * \return Time spent pacing (sleeping and spinning) in the last readout
+	 *
+	 * The rest of the call's time went into generating the data, so a caller
+	 * timing FillBuffer can tell the two apart.
+	 */
+	std::chrono::steady_clock::duration LastTriggerWait() const;
+
+	/**
+	 * \brief How late the last FillBuffer/FillBuffers/FillBatch call read out its (first) trigger
+	 * \return Time between the trigger coming due and the call starting to read it out; zero if the call had to wait
+	 *
+	 * This is the latency the consumer adds on top of the trigger clock. It
+	 * grows without bound once the consumer can't keep up with the rate.
+	 */
+	std::chrono::steady_clock::duration LastTriggerLateness() const;
+
+	/**
+	 * \brief Replace the rate_table with a single periodic entry, from now until the next StartDatataking
+	 * \param size_bytes Size of each readout, as a rate_table "size_bytes"; at most the largest size in the rate_table
+	 * \param rate_hz Trigger rate (0: as fast as possible)
+	 *
+	 * Pacing restarts from the moment of the call, so that triggers which were
+	 * due at the old rate are not carried over. Meant for closed-loop rate
+	 * control by the caller; not available with the readout ring or the
+	 * streaming readout, whose threads pace themselves.
+	 */
+	void SetRate(size_t size_bytes, size_t rate_hz);
+
+	/**
+	 * \brief Whether the readout size varies from event to event (a rate_table entry has a size_distribution)
+	 * \return True if any rate_table entry's size_distribution isn't "fixed"
+	 */
+	bool ReadoutSizeVaries() const;
+
+	/**
+	 * \brief Whether readouts of a given size fit the readout buffers, which are sized for the largest size in the rate_table
+	 * \param size_bytes Size of a readout, as a rate_table "size_bytes"
+	 * \return True if SetRate would accept the size
+	 */
+	bool FitsReadoutBuffers(size_t size_bytes) const;
+
+	/**
+	 * \brief Whether readouts copy pregenerated payloads ("pattern_bank_size" > 0)
+	 * \return True if the pattern bank is in use
+	 */
+	bool PatternBankEnabled() const;
+
+	/**
+	 * \brief Whether the hardware fills a ring of readout buffers on its own ("readout_ring_buffers" > 0)
+	 * \return True if the readout ring is enabled
+	 */
+	bool ReadoutRingEnabled() const;
+
+	/**
+	 * \brief Wait for the next buffer filled by the readout ring
+	 * \param buffer (output) Filled buffer, to be returned with FreeReadoutBuffer once consumed
+	 * \param bytes_read (output) Number of bytes in the buffer
+	 * \param timeout_us How long to wait for a buffer, in microseconds
+	 * \return True if a buffer was returned, false on timeout
+	 *
+	 * Buffers are returned in the order they were filled. An exception thrown
+	 * by the ring thread (e.g. an engineered one) is rethrown here.
+	 */
+	bool WaitForReadout(char** buffer, size_t* bytes_read, size_t timeout_us);
+
+	/**
+	 * \brief Deadtime counters of the readout ring, as a DMA engine would expose them
+	 */
+	struct ReadoutRingStatistics
+	{
+		uint64_t triggers;      ///< Triggers seen by the hardware since StartDatataking
+		uint64_t overflows;     ///< Triggers lost because every ring buffer was in use
+		double busy_seconds;    ///< Total time during which every ring buffer was in use
+		size_t buffers_filled;  ///< Buffers currently waiting for the consumer
+		size_t buffers_total;   ///< Number of buffers in the ring
+	};
+
+	/**
+	 * \brief Get the current deadtime counters of the readout ring
+	 * \return The readout ring counters (all zero if the ring is not enabled)
+	 */
+	ReadoutRingStatistics GetReadoutRingStatistics() const;
+
+	/**
+	 * \brief One timestamped hit, as written by the streaming readout
+	 *
+	 * A hit is three data_t words, so a window of hits packs exactly into a
+	 * ToyFragment payload (after the header, in place of the ADC values).
+	 */
+	struct HitRecord
+	{
+		uint32_t timestamp_low;   ///< Low 32 bits of the hit time, in streaming_clock_hz ticks since StartDatataking
+		uint32_t timestamp_high;  ///< High 32 bits of the hit time
+		uint16_t channel;         ///< Channel which was hit
+		uint16_t adc;             ///< Pulse height
+
+		/**
+		 * \brief The full 64-bit hit time
+		 * \return Hit time, in streaming_clock_hz ticks since StartDatataking
+		 */
+		uint64_t Timestamp() const { return (static_cast<uint64_t>(timestamp_high) << 32) | timestamp_low; }
+	};
+
+	/**
+	 * \brief Outcome of ReadWindow
+	 */
+	enum class WindowStatus
+	{
+		complete,  ///< Every hit of the window was still buffered
+		partial,   ///< Some hits of the window had already been overwritten; the rest were read out
+		pending    ///< The clock hasn't reached the end of the window yet; nothing was read out
+	};
+
+	/**
+	 * \brief Whether this is a streaming readout ("hits" distribution), read out with ReadWindow
+	 * \return True if the hardware streams hits into its ring
+	 */
+	bool StreamingEnabled() const;
+
+	/**
+	 * \brief Read out the hits in a time window of the streaming readout
+	 * \param begin First tick of the window
+	 * \param end Tick just past the end of the window
+	 * \param allocate Called (once, unless the window is pending) with the size of the readout in bytes; returns
+	 * the buffer to write it to, e.g. the payload of a freshly allocated Fragment
+	 * \param bytes_read Number of bytes written: a ToyFragment header, then the window's HitRecords. Less than
+	 * the size passed to allocate if some of the hits were overwritten while it ran
+	 * \return Whether the window was read out in full, in part, or not yet
+	 *
+	 * The hits are found by binary search on their timestamps and copied
+	 * straight from the ring into the caller's buffer. allocate is called
+	 * without holding up the thread which writes the hits.
+	 */
+	WindowStatus ReadWindow(uint64_t begin, uint64_t end, std::function<char*(size_t)> const& allocate, size_t* bytes_read);
+
+	/**
+	 * \brief State of the streaming readout's hit ring
+	 */
+	struct StreamingStatistics
+	{
+		uint64_t clock_ticks;   ///< Current hit clock; every hit up to it has been written
+		double clock_hz;        ///< Frequency of the hit clock
+		uint64_t hits_written;  ///< Hits written since StartDatataking
+		size_t hits_buffered;   ///< Hits currently held in the ring
+		double depth_seconds;   ///< Time span covered by the buffered hits
+	};
+
+	/**
+	 * \brief Get the current state of the streaming readout
+	 * \return The hit ring counters (all zero if streaming is not enabled)
+	 */
+	StreamingStatistics GetStreamingStatistics() const;
+
 	/**
 	 * \brief Request a buffer from the hardware
 	 * \param buffer (output) Pointer to buffer
@@ -56,9 +424,30 @@ public:
 	/**
 	 * \brief Release the given buffer to the hardware
 	 * \param buffer Buffer to release
+	 *
+	 * Buffers obtained from WaitForReadout go back to the readout ring.
 	 */
 	void FreeReadoutBuffer(const char* buffer);
 
+	/**
+	 * \brief Pay the first-use costs of the readout ahead of time
+	 * \param buffer A buffer from AllocateReadoutBuffer, to be warmed up too (may be nullptr)
+	 *
+	 * Faults in the pages of the readout ring and of the given buffer, and
+	 * generates one throwaway readout of the largest size in the rate_table,
+	 * which primes the distribution tables, the fill threads and the caches.
+	 * The data generated later are not affected.
+	 */
+	void WarmUp(char* buffer);
+
+	/**
+	 * \brief Bind the calling thread to the NUMA node of the readout buffers, if "numa_node" is set
+	 *
+	 * The hardware interface's own threads bind themselves; this is for the
+	 * thread which calls FillBuffer.
+	 */
+	void BindReadoutThread() const;
+
 	/**
 	 * \brief Gets the serial number of the simulated hardware
 	 * \return Serial number of the simulated hardware
@@ -77,6 +466,15 @@ public:
 	 */
 	int BoardType() const;
 
+	/**
+	 * \brief Source of the random numbers used for the generated data
+	 */
+	enum class RandomMode
+	{
+		stream,  ///< Keyed on the random seed and the readout number
+		counter  ///< Keyed on the random seed, sequence ID, fragment ID and sample index (Philox4x32-10)
+	};
+
 	/**
 	 * \brief Allow for the selection of output distribution
 	 */
@@ -86,16 +484,47 @@ public:
 		gaussian,       ///< A Gaussian distribution
 		monotonic,      ///< A monotonically-increasing distribution
 		uninitialized,  ///< A use-after-free expliot distribution
-		uninit2         // like uninitialized, but do memcpy
+		uninit2,        // like uninitialized, but do memcpy
+		sparse,         ///< A noisy baseline with sparse pulses, of tunable compressibility
+		waveform,       ///< A digitized detector signal: pedestal, correlated noise and shaped pulses
+		hits            ///< Trigger-less streaming readout of timestamped hits, read out by time window
 	};
 
 private:
 	bool taking_data_;
 
+	enum class TriggerModel
+	{
+		periodic,
+		poisson,
+		burst,
+		spill
+	};
+
+	enum class SizeDistribution
+	{
+		fixed,
+		lognormal,
+		exponential,
+		histogram
+	};
+
 	struct RateInfo {
 		std::size_t size_bytes;
+		SizeDistribution size_distribution = SizeDistribution::fixed;
+		double size_sigma = 0;
+		std::size_t size_min = 0;
+		std::size_t size_max = 0;  // The largest readout this entry can produce
+		std::vector<std::size_t> histogram_sizes;
+		std::discrete_distribution<std::size_t> histogram;  // Index into histogram_sizes
 		std::size_t rate_hz;
 		std::chrono::microseconds duration;
+		TriggerModel model = TriggerModel::periodic;
+		double burst_rate_hz = 0;
+		std::chrono::microseconds mean_quiet{0};
+		std::chrono::microseconds mean_burst{0};
+		std::chrono::microseconds spill_on{0};
+		std::chrono::microseconds spill_off{0};
 	};
 
 	std::size_t change_after_N_seconds_;
@@ -108,6 +537,8 @@ private:
 	std::size_t maxADCvalue_;
 	DistributionType distribution_type_;
 	std::vector<RateInfo> configured_rates_;
+	std::vector<RateInfo> override_rates_;  // Set by SetRate, until the next StartDatataking
+	std::vector<RateInfo>* rates_;          // The table being paced: configured_rates_ or override_rates_
 	std::vector<RateInfo>::iterator current_rate_;
 
 	using time_type = decltype(std::chrono::steady_clock::now());
@@ -118,19 +549,120 @@ private:
 
 	std::mt19937 engine_;
 	std::unique_ptr<std::uniform_int_distribution<demo::ToyFragment::adc_t>> uniform_distn_;
-	std::unique_ptr<std::normal_distribution<double>> gaussian_distn_;
+	std::unique_ptr<demo::GaussianAliasTable> gaussian_table_;
+	std::unique_ptr<demo::SparsePulseModel> sparse_model_;
+	std::unique_ptr<demo::WaveformModel> waveform_model_;
+	uint64_t random_seed_;
+	RandomMode random_mode_;
+	uint64_t readout_count_;
+
+	// Everything the random numbers of one readout may be keyed on
+	struct ReadoutKey
+	{
+		uint64_t readout_number;
+		uint64_t sequence_id;
+		uint16_t fragment_id;
+	};
+
+	// The per-distribution ADC generator is picked once, at configuration
+	// time; FillBuffer then makes a single call per buffer
+	using adc_generator_t = void (ToyHardwareInterface::*)(demo::ToyFragment::adc_t*, size_t, size_t, ReadoutKey const&) const;
+	adc_generator_t adc_generator_;
+
+	std::vector<std::vector<demo::ToyFragment::adc_t>> pattern_bank_;
+
+	demo::ReadoutMemory readout_memory_;
+	std::unique_ptr<demo::FillWorkerPool> fill_pool_;
+	size_t fill_chunk_adcs_;
+
+	size_t channels_;
+	demo::ToyChannelLayout::Order channel_order_;
+	std::vector<std::vector<demo::ToyFragment::adc_t>> interleave_scratch_;  // Channel-major data of each buffer, before interleaving
+	std::vector<size_t> buffer_adcs_;                                        // ADC values of each buffer of the fill in progress
+
+	// Asynchronous readout ring; everything from ring_free_ on is guarded by ring_mutex_
+
+	struct RingEntry
+	{
+		char* buffer;
+		size_t bytes_read;
+	};
+
+	std::vector<char*> ring_buffers_;
+	uint16_t ring_fragment_id_;
+	std::thread ring_thread_;
+	mutable std::mutex ring_mutex_;
+	std::condition_variable ring_filled_cv_;
+	std::condition_variable ring_stop_cv_;
+	std::vector<char*> ring_free_;
+	std::deque<RingEntry> ring_filled_;
+	bool ring_running_;
+	std::exception_ptr ring_exception_;
+	uint64_t ring_triggers_;
+	uint64_t ring_overflows_;
+	std::chrono::steady_clock::duration ring_busy_time_;
+	bool ring_full_;
+	time_type ring_full_since_;
+
+	// Streaming readout; everything from hit_ring_ on is guarded by stream_mutex_
+
+	double hit_rate_hz_;
+	double hit_clock_hz_;
+	uint16_t hit_channels_;
+	std::chrono::microseconds stream_period_;
+	std::thread stream_thread_;
+	mutable std::mutex stream_mutex_;
+	std::condition_variable stream_stop_cv_;
+	std::vector<HitRecord> hit_ring_;
+	uint64_t hits_written_;
+	uint64_t stream_clock_;             // Every hit before this tick has been written
+	uint64_t last_overwritten_tick_;    // Time of the newest hit lost to the ring wrapping around
+	bool stream_running_;
 
 	time_type start_time_;
 	time_type rate_start_time_;
-	int rate_send_calls_;
+	uint64_t rate_send_calls_;  // Triggers so far in the current rate_table entry
+	time_type next_trigger_;
+	std::chrono::steady_clock::duration last_trigger_wait_;
+	std::chrono::steady_clock::duration last_trigger_lateness_;
+	std::chrono::nanoseconds spin_threshold_;
+	std::mt19937_64 trigger_engine_;
+	std::mt19937_64 size_engine_;
+	std::size_t next_size_bytes_;  // Drawn ahead of the readout, for ReadoutSizeBytes
+	demo::SizeHistogram readout_sizes_;
+	bool in_burst_;                // "burst" trigger model: which state we're in...
+	time_type burst_state_end_;    // ...and until when
 	int serial_number_;
 
-	
-	std::chrono::microseconds rate_to_delay_(std::size_t hz);
-	std::chrono::steady_clock::time_point next_trigger_time_();
-	size_t bytes_to_nWords_(size_t bytes);
-	size_t bytes_to_nADCs_(size_t bytes);
-	size_t maxADCcounts_();
+	void apply_engineered_disruptions_();
+	void wait_for_trigger_();
+	void advance_trigger_();
+	void begin_rate_entry_(time_type start);
+	time_type draw_trigger_after_(time_type from);
+	std::chrono::nanoseconds draw_exponential_(double mean_seconds);
+	std::size_t draw_readout_size_();
+	void parse_size_distribution_(fhicl::ParameterSet const& pps, RateInfo& rate);
+	void ring_loop_();
+	void stream_loop_();
+
+	size_t take_trigger_();
+	size_t scaled_size_bytes_(size_t bytes, double size_scale) const;
+
+	template<class SIZE_OF, class KEY_OF>
+	void fill_readouts_(char* const* buffers, size_t nbuffers, SIZE_OF const& size_of, KEY_OF const& key_of);
+
+	void interleave_channels_(char* const* buffers, size_t nbuffers);
+
+	template<DistributionType DIST>
+	void generate_adcs_(demo::ToyFragment::adc_t* adcs, size_t begin, size_t end, ReadoutKey const& key) const;
+	void copy_pattern_(demo::ToyFragment::adc_t* adcs, size_t begin, size_t end, ReadoutKey const& key) const;
+	template<DistributionType DIST, class STREAM>
+	void run_kernel_(demo::ToyFragment::adc_t* adcs, size_t begin, size_t end, STREAM const& stream) const;
+
+	std::chrono::nanoseconds trigger_offset_(RateInfo const& rate, uint64_t trigger) const;
+	size_t bytes_to_nWords_(size_t bytes) const;
+	size_t bytes_to_nADCs_(size_t bytes) const;
+	size_t maxADCcounts_() const;
 };
 
 #endif
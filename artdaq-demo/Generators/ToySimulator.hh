@@ -11,10 +11,19 @@
 #include "artdaq/Generators/CommandableFragmentGenerator.hh"
 #include "fhiclcpp/fwd.h"
 
+#include "DeliveryPerturbation.hh"
+#include "FragmentPool.hh"
+#include "RateRamp.hh"
+#include "RequestWindow.hh"
+#include "SPSCQueue.hh"
+#include "StageHistogram.hh"
 #include "ToyHardwareInterface/ToyHardwareInterface.hh"
 
 #include <atomic>
+#include <exception>
+#include <memory>
 #include <random>
+#include <thread>
 #include <vector>
 
 namespace demo {
@@ -44,6 +53,104 @@ public:
 	 * "distribution_type" (REQUIRED): Which type of distribution to use when generating data. See ToyHardwareInterface
 	 * for more information "rollover_subrun_interval" (Default: 0): If this ToySimulator has fragment_id 0, will cause
 	 * the system to rollover subruns every N events. 0 (default) disables.
+	 * "zero_copy_readout" (Default: false): Have the hardware interface write directly into the payload of the
+	 * Fragment instead of into a readout buffer obtained from AllocateReadoutBuffer which is then copied
+	 * "fanout_mode" (Default: "copy"): How the Fragments for multiple fragment IDs are produced from one readout.
+	 * "copy" copies one readout into every Fragment; "generate" has the hardware interface fill every Fragment
+	 * in place (in parallel if fill_threads > 1), each with its own random stream
+	 * If the hardware interface's "readout_ring_buffers" is set, ToySimulator consumes the buffers filled by the
+	 * readout ring (copying each into the Fragments) and reports the ring's overflow and busy counters as metrics;
+	 * this requires the default "copy" fanout_mode without zero_copy_readout.
+	 * "max_trigger_batch" (Default: 1): Once fragment_group_size events have been read out, keep reading out
+	 * triggers which are already due (see ToyHardwareInterface::PendingTriggers), up to this many events per
+	 * call, so that a high trigger rate isn't limited by the per-call overhead of getNext_
+	 * "lazy_batch_size" (Default: 0): In lazy_mode, serve up to this many pending requests per call to getNext_,
+	 * reading out all of their triggers at once and filling their Fragments in place in a single pass (spread over the
+	 * hardware interface's fill_threads). 0 serves one request per call. The whole batch is read out at the size
+	 * current when it starts, so a batch which runs into the next rate_table entry keeps the previous entry's size;
+	 * for the same reason it is not available with a rate_table size_distribution. Not available with
+	 * rollover_subrun_interval, as a batch sends no EndOfSubrun Fragments.
+	 * "lazy_request_window" (Default: 65536): How many of the most recent sequence IDs lazy_mode remembers, to avoid
+	 * serving a request twice; requests older than that are taken to have been served
+	 * "stage_metrics_interval_s" (Default: 1.0): How often to send the per-stage timing metrics (level 4): P50, P90,
+	 * P99 and maximum time, duty cycle and throughput of the pacing wait, FillBuffer, Fragment allocation, memcpy and
+	 * subrun rollover stages of getNext_. 0 disables the timers altogether. The process's minor and major page fault
+	 * rates are sent at the same interval (level 3), e.g. to check that readout buffers placed with the hardware
+	 * interface's readout_buffer_pages or readout_buffer_mlock aren't faulting during the run. So are the mean, median,
+	 * 99th percentile and maximum readout size ("Fragment Size ..." metrics, level 3), which vary from event to event
+	 * if the rate_table sets a size_distribution (see ToyHardwareInterface).
+	 * If the hardware interface's "numa_node" is set, the thread calling getNext_ is bound to that node's CPUs, as are
+	 * each board's thread in multi-board mode (unless its entry pins it to a "cpu").
+	 * "warm_start" (Default: true): Take the first-use costs out of the first events of a run. At configuration, the
+	 * hardware interface warms up its readout buffers and data generation (see ToyHardwareInterface::WarmUp). At
+	 * configuration and at every stop, the Fragments of the next run's first fragment_group_size (or lazy_batch_size)
+	 * events are allocated, at the largest size the first rate_table entry reads out, and their pages faulted in.
+	 * Either way, the time from the start transition to the first Fragment is sent as the "Start To First Fragment"
+	 * metric.
+	 * "fragment_pool_depth" (Default: 0): If non-zero, Fragments are allocated ahead of time by a background thread
+	 * and kept ready, this many per power-of-two size class in use (see demo::FragmentPool), so that getNext_ only
+	 * takes one instead of allocating a payload and faulting its pages in. Each class is refilled at the size last asked
+	 * of it. A size class is stocked from its first use on; until then (or if the pool runs dry) Fragments are allocated
+	 * as usual. The pool's hit rate and the number of allocations left
+	 * on the data path are sent with the stage metrics ("Fragment Pool Hit Rate", "Fragment Pool Ready Bytes" and
+	 * "Fragment Allocations", level 3).
+	 * "fragment_pool_refill_us" (Default: 100): How often the pool's thread tops it up, at the latest
+	 * "container_packing" (Default: "none"): Pack the Fragments of each call to getNext_ into artdaq ContainerFragments,
+	 * so that the rest of the DAQ chain handles one Fragment where it would have handled many. "group" packs the events
+	 * of the group (fragment_group_size events, plus those added by max_trigger_batch) into one container per fragment
+	 * ID, which takes the sequence ID and timestamp of the group's first event: downstream, a group is one event.
+	 * "event" packs the Fragments of all fragment IDs of an event into one container, with the first fragment ID.
+	 * The containers' sizes are sent as the "Fragments Per Container" metric (level 3). Not available with lazy_mode,
+	 * boards, the streaming readout or rollover_subrun_interval.
+	 * "fragment_id_overrides" (Default: []): Make the fragment IDs of an event differ from one another, e.g. to see
+	 * how the event builder copes with skewed and incomplete events. Each entry applies to the fragment ID given by
+	 * its "fragment_id", which must be one of fragment_ids:
+	 * "size_scale" (Default: 1.0): Payload size of the ID's Fragments relative to the readout's, rounded to whole
+	 * header words (requires fanout_mode "generate", which fills each Fragment at its own size, and is at most 1 with the
+	 * hardware interface's pattern_bank_size);
+	 * "prescale" (Default: 1): Only send the ID's Fragment for sequence IDs divisible by this;
+	 * "missing_fraction" (Default: 0): Leave out this fraction of the ID's remaining Fragments, at random but the
+	 * same way every run with the same random_seed.
+	 * An event's readout happens whichever of its Fragments are left out. The Fragments left out count towards
+	 * fragment_group_size and are sent as the "Fragments Missing" metric (level 3). Not available with batched
+	 * lazy_mode (lazy_batch_size), boards or the streaming readout.
+	 * "delivery_reorder_window" (Default: 0), "delivery_jitter_us" (Default: 0), "delivery_late_fraction" (Default: 0),
+	 * "delivery_late_us" (Default: 0): Deliver the Fragments out of order and with varying delays, e.g. to see how the
+	 * event builder's latency and buffer occupancy depend on the disorder (see demo::DeliveryPerturbation). Each
+	 * Fragment is held back until up to delivery_reorder_window more have been read out, and for up to
+	 * delivery_jitter_us; a delivery_late_fraction of them are held for a further delivery_late_us. Held Fragments are
+	 * only released by calls to getNext_, and all of them at the end of data taking; any still held when the run stops
+	 * are dropped, with a warning. The Fragments held, those delivered out of order or late and those dropped are sent
+	 * as the "Delivery Held Fragments", "Delivery Out Of Order Fragments", "Delivery Late Fragments" and "Delivery
+	 * Dropped Fragments" metrics (level 3).
+	 * With the hardware interface's streaming readout (distribution_type 7, "hits"), every request is served with the
+	 * hits in a time window around its timestamp, which is taken to be in streaming_clock_hz ticks. A request waits
+	 * until the hardware clock has passed the end of its window; a window whose oldest hits have already been
+	 * overwritten is sent with what is left, and counted in the "Streaming Windows Lost" metric.
+	 * "streaming_window_offset" (Default: 0): How many ticks before the request timestamp the window begins
+	 * "streaming_window_width" (Default: 100000): The length of the window, in ticks
+	 * "boards" (Default: []): Emulate a crate of several boards in this one generator. Each entry is the complete
+	 * ToyHardwareInterface configuration of one board (fragment_type, distribution_type, rate_table, random_seed, ...),
+	 * read out as the fragment ID at the same position in fragment_ids. Every board runs on a worker thread of its own,
+	 * pinned to CPU "cpu" if the entry sets it, and writes its Fragments into a lock-free queue which getNext_ drains.
+	 * The boards' triggers are matched by count, so they should share a trigger rate; readout sizes may differ.
+	 * Requests, the readout ring, zero_copy_readout, fanout_mode and subrun rollover are not used with boards.
+	 * "board_queue_depth" (Default: 1024): How many Fragments each board can queue before it waits for getNext_
+	 * "rate_ramp" (Default: false): Find the highest rate the downstream system sustains, in one run. The rate_table is
+	 * replaced by a periodic trigger whose rate steps up by ramp_rate_factor every ramp_step_s, starting from
+	 * ramp_start_rate_hz, for each of ramp_sizes_bytes in turn. A step is stable if it reads out triggers at its rate
+	 * (within ramp_rate_tolerance), ends with at most ramp_max_backlog triggers due but not read out, keeps the P99
+	 * latency from trigger to readout within ramp_max_latency_us and reads out at most ramp_max_miss_fraction of the
+	 * triggers after the next one was already due. The first unstable step (or ramp_max_rate_hz) ends the ramp at that
+	 * size. Each step is logged and sent as the "Ramp Rate", "Ramp Achieved Rate", "Ramp Size" and "Ramp Trigger
+	 * Latency P99" metrics; at the end, the highest stable rate at each size is logged, the best combination is sent
+	 * as "Ramp Max Stable Rate" and "Ramp Max Stable Throughput", and data taking ends.
+	 * Not available with lazy_mode, boards, the readout ring or the streaming readout.
+	 * "ramp_sizes_bytes" (Default: [the first rate_table size]): Readout sizes to ramp, each at most the largest
+	 * rate_table size
+	 * "ramp_start_rate_hz" (Default: 100), "ramp_rate_factor" (Default: 1.25), "ramp_max_rate_hz" (Default: 1000000),
+	 * "ramp_step_s" (Default: 2.0), "ramp_rate_tolerance" (Default: 0.02), "ramp_max_backlog" (Default: 100),
+	 * "ramp_max_latency_us" (Default: 10000), "ramp_max_miss_fraction" (Default: 0.1): See rate_ramp
 	 */
 	explicit ToySimulator(fhicl::ParameterSet const& ps);
 
@@ -67,6 +174,29 @@ private:
 	 */
 	bool getNext_(artdaq::FragmentPtrs& frags) override;
 
+	/**
+	 * \brief The body of getNext_: read out the hardware into new Fragments
+	 * \param frags New FragmentPtrs will be added to this container
+	 * \return True if data-taking should continue
+	 */
+	bool read_out_(artdaq::FragmentPtrs& frags);
+
+	/**
+	 * \brief Warm start: allocate (and fault in) the Fragments for the first events of the next run
+	 */
+	void prepare_warm_fragments_();
+
+	/**
+	 * \brief Get a Fragment for this board's data: one allocated ahead of the run if any are left, else one from the
+	 * fragment pool, else a new one
+	 * \param bytes Payload size
+	 * \param sequence_id Sequence ID of the Fragment
+	 * \param fragment_id Fragment ID of the Fragment
+	 * \param timestamp Timestamp of the Fragment
+	 * \return The Fragment, with this generator's type and metadata
+	 */
+	artdaq::FragmentPtr make_fragment_(size_t bytes, artdaq::Fragment::sequence_id_t sequence_id, artdaq::Fragment::fragment_id_t fragment_id, artdaq::Fragment::timestamp_t timestamp);
+
 	// The start, stop and stopNoMutex methods are declared pure
 	// virtual in CommandableFragmentGenerator and therefore MUST be
 	// overridden; note that stopNoMutex() doesn't do anything here
@@ -91,6 +221,102 @@ private:
 	 */
 	void stopNoMutex() override {}
 
+	/**
+	 * \brief Send the stage timers' percentiles, duty cycles and throughputs to metricMan, and reset them
+	 */
+	void send_stage_metrics_();
+
+	/**
+	 * \brief Batched lazy_mode: serve every pending request in one pass
+	 * \param frags New FragmentPtrs will be added to this container
+	 * \return True if data-taking should continue
+	 */
+	bool serve_request_batch_(artdaq::FragmentPtrs& frags);
+
+	/**
+	 * \brief Streaming readout: serve every pending request whose time window has been recorded
+	 * \param frags New FragmentPtrs will be added to this container
+	 * \return True if data-taking should continue
+	 */
+	bool serve_window_requests_(artdaq::FragmentPtrs& frags);
+
+	/**
+	 * \brief One emulated board of a multi-board crate, with its worker thread and output queue
+	 */
+	struct Board
+	{
+		Board(fhicl::ParameterSet const& ps, artdaq::Fragment::fragment_id_t id, size_t queue_depth);
+
+		std::unique_ptr<ToyHardwareInterface> hardware;
+		artdaq::Fragment::fragment_id_t fragment_id;
+		int cpu;  // -1: not pinned
+		FragmentType fragment_type;
+		ToyFragment::Metadata metadata;
+
+		std::thread thread;
+		std::atomic<bool> running;
+		std::atomic<bool> failed;
+		std::exception_ptr exception;  // Set by the worker before it sets failed
+		std::atomic<size_t> stalls;    // Fragments which found the queue full
+		SPSCQueue<artdaq::FragmentPtr> queue;
+		artdaq::Fragment::sequence_id_t delivered;  // Sequence ID after the last one getNext_ took from the queue
+	};
+
+	/**
+	 * \brief Worker thread of one board: read it out on its own trigger clock and queue the Fragments
+	 * \param board The board to read out
+	 * \param sequence_id Sequence ID of the first Fragment
+	 */
+	void board_loop_(Board& board, artdaq::Fragment::sequence_id_t sequence_id);
+
+	/**
+	 * \brief Multi-board mode: collect the Fragments queued by the boards' worker threads
+	 * \param frags New FragmentPtrs will be added to this container
+	 * \return True if data-taking should continue
+	 */
+	bool merge_boards_(artdaq::FragmentPtrs& frags);
+
+	void start_boards_();
+	void stop_boards_();
+
+	/**
+	 * \brief Rate ramp: at the end of a step, judge it and set the next step's rate and size
+	 * \return False once the ramp is over, so that data taking ends
+	 */
+	bool step_rate_ramp_();
+
+	/**
+	 * \brief Container packing: replace the Fragments of this call with ContainerFragments holding them
+	 * \param frags The Fragments to pack, replaced by the containers
+	 */
+	void pack_containers_(artdaq::FragmentPtrs& frags);
+
+	/**
+	 * \brief Whether a fragment ID's Fragment of an event is sent, according to fragment_id_overrides
+	 * \param index Position of the fragment ID in fragmentIDs()
+	 * \param sequence_id Sequence ID of the event
+	 * \return False if the Fragment is prescaled away or missing
+	 */
+	bool fragment_present_(size_t index, artdaq::Fragment::sequence_id_t sequence_id) const;
+
+	/**
+	 * \brief Delivery perturbation: hold back this call's Fragments, and release those which are due
+	 * \param frags The Fragments read out; replaced by the Fragments released
+	 * \param more Whether data taking continues; if not, every Fragment still held is released
+	 */
+	void perturb_delivery_(artdaq::FragmentPtrs& frags, bool more);
+
+	/**
+	 * \brief Per-fragment-ID size and rate, see "fragment_id_overrides"
+	 */
+	struct FragmentIDOverride
+	{
+		artdaq::Fragment::fragment_id_t fragment_id;
+		double size_scale;        // Payload size relative to the readout's
+		uint64_t prescale;        // Sent for sequence IDs divisible by this
+		double missing_fraction;  // Fraction of the prescaled Fragments left out
+	};
+
 	std::unique_ptr<ToyHardwareInterface> hardware_interface_;
 	artdaq::Fragment::timestamp_t timestamp_;
 	artdaq::Fragment::timestamp_t starting_timestamp_;
@@ -108,16 +334,73 @@ private:
 	// C++03-style API for greater realism
 
 	char* readout_buffer_;
+	bool zero_copy_readout_;
+
+	enum class FanoutMode
+	{
+		copy,
+		generate
+	};
+	FanoutMode fanout_mode_;
+	std::vector<char*> fanout_buffers_;
 
 	FragmentType fragment_type_;
 	ToyHardwareInterface::DistributionType distribution_type_;
 	size_t fragment_group_size_;
+	size_t max_trigger_batch_;
 	std::chrono::microseconds fragment_group_timeout_;
 	bool exception_on_config_;
 	bool dies_on_config_;
 
 	bool lazy_mode_;  // See Issue #22810
-	std::set<artdaq::Fragment::sequence_id_t> lazily_handled_requests_;
+	size_t lazy_batch_size_;
+	RequestWindow lazily_handled_requests_;
+	std::vector<std::pair<artdaq::Fragment::sequence_id_t, artdaq::Fragment::timestamp_t>> request_batch_;
+	std::vector<uint64_t> batch_sequence_ids_;
+
+	uint64_t streaming_window_offset_;
+	uint64_t streaming_window_width_;
+	size_t streaming_windows_lost_;
+
+	std::vector<std::unique_ptr<Board>> boards_;
+
+	std::unique_ptr<RateRamp> rate_ramp_;  // nullptr unless rate_ramp is set
+
+	enum class ContainerPacking
+	{
+		none,
+		group,
+		event
+	};
+	ContainerPacking container_packing_;
+	std::vector<std::pair<uint64_t, artdaq::FragmentPtrs>> containers_;  // Container key (fragment or sequence ID), contents
+
+	std::vector<FragmentIDOverride> fragment_id_overrides_;  // In fragmentIDs() order; empty unless fragment_id_overrides is set
+	uint64_t missing_key_;                                   // Random stream key of the missing Fragments
+	std::vector<double> fanout_scales_;                      // Size scale of each of fanout_buffers_
+	std::vector<artdaq::Fragment::fragment_id_t> fanout_ids_;  // Fragment ID of each of fanout_buffers_
+
+	std::unique_ptr<DeliveryPerturbation> delivery_perturbation_;  // nullptr unless a delivery_ parameter is set
+
+	std::unique_ptr<FragmentPool<ToyFragment::Metadata>> fragment_pool_;  // nullptr unless fragment_pool_depth is set
+	uint64_t fragment_allocations_;                                       // Fragments make_fragment_ had to allocate itself
+
+	// Warm start: see ToyHardwareInterface::WarmUp
+	bool warm_start_;
+	std::vector<artdaq::FragmentPtr> warm_fragments_;  // Allocated and faulted in at start, used by the first events
+	bool awaiting_first_fragment_;
+	std::chrono::steady_clock::time_point start_transition_time_;
+
+	// Hot-path stage timers, flushed every stage_metrics_interval_
+	std::chrono::duration<double> stage_metrics_interval_;
+	std::chrono::steady_clock::time_point last_stage_metrics_;
+	ReadoutMemory::PageFaults last_page_faults_;
+	bool bind_readout_thread_;
+	StageHistogram pacing_wait_timer_;
+	StageHistogram fill_timer_;
+	StageHistogram allocate_timer_;
+	StageHistogram copy_timer_;
+	StageHistogram rollover_timer_;
 };
 }  // namespace demo
 
@@ -10,18 +10,37 @@
 
 #include "artdaq-core-demo/Overlays/FragmentType.hh"
 #include "artdaq-core-demo/Overlays/ToyFragment.hh"
+#include "artdaq-core/Data/ContainerFragmentLoader.hh"
 #include "artdaq-core/Utilities/SimpleLookupPolicy.hh"
 #include "artdaq/Generators/GeneratorMacros.hh"
 
 #define TRACE_NAME "ToySimulator"
 #include "TRACE/tracemf.h"  // TRACE, TLOG*
 
+#include <pthread.h>
 #include <unistd.h>
+#include <algorithm>
 #include <fstream>
 #include <iomanip>
 #include <iostream>
 #include <iterator>
 
+namespace {
+// The hardware's vendor-defined board type, as the FragmentType it reads out
+demo::FragmentType board_fragment_type(int board_type)
+{
+	switch (board_type)
+	{
+		case 1002:
+			return demo::toFragmentType("TOY1");
+		case 1003:
+			return demo::toFragmentType("TOY2");
+		default:
+			throw cet::exception("ToySimulator") << "Unable to determine board type supplied by hardware";  // NOLINT(cert-err60-cpp)
+	}
+}
+}  // namespace
+
 demo::ToySimulator::ToySimulator(fhicl::ParameterSet const& ps)
     : CommandableFragmentGenerator(ps)
     , hardware_interface_(new ToyHardwareInterface(ps))
@@ -33,16 +52,75 @@ demo::ToySimulator::ToySimulator(fhicl::ParameterSet const& ps)
     , rollover_subrun_interval_(ps.get<int>("rollover_subrun_interval", 0))
     , metadata_({0, 0, 0})
     , readout_buffer_(nullptr)
+    , zero_copy_readout_(ps.get<bool>("zero_copy_readout", false))
+    , fanout_mode_(FanoutMode::copy)
     , fragment_type_(static_cast<decltype(fragment_type_)>(artdaq::Fragment::InvalidFragmentType))
     , distribution_type_(static_cast<ToyHardwareInterface::DistributionType>(ps.get<int>("distribution_type")))
     , fragment_group_size_(ps.get<int>("fragment_group_size", 1))
+    , max_trigger_batch_(ps.get<size_t>("max_trigger_batch", 1))
     , fragment_group_timeout_(ps.get<int>("fragment_group_timeout_us", 1000000))
     , exception_on_config_(ps.get<bool>("exception_on_config", false))
     , dies_on_config_(ps.get<bool>("dies_on_config", false))
     , lazy_mode_(ps.get<bool>("lazy_mode", false))
+    , lazy_batch_size_(ps.get<size_t>("lazy_batch_size", 0))
+    , lazily_handled_requests_(ps.get<size_t>("lazy_request_window", 65536))
+    , streaming_window_offset_(ps.get<uint64_t>("streaming_window_offset", 0))
+    , streaming_window_width_(ps.get<uint64_t>("streaming_window_width", 100000))
+    , streaming_windows_lost_(0)
+    , container_packing_(ContainerPacking::none)
+    , missing_key_(SplitMixStream{static_cast<uint64_t>(ps.get<int64_t>("random_seed", 314159))}(0x4D495353))  // "MISS"
+    , fragment_pool_(nullptr)
+    , fragment_allocations_(0)
+    , warm_start_(ps.get<bool>("warm_start", true))
+    , awaiting_first_fragment_(false)
+    , stage_metrics_interval_(ps.get<double>("stage_metrics_interval_s", 1.0))
+    , last_page_faults_({0, 0})
+    , bind_readout_thread_(false)
 
 {
-	hardware_interface_->AllocateReadoutBuffer(&readout_buffer_);
+	auto fanout_mode = ps.get<std::string>("fanout_mode", "copy");
+	if (fanout_mode == "generate")
+	{
+		fanout_mode_ = FanoutMode::generate;
+	}
+	else if (fanout_mode != "copy")
+	{
+		throw cet::exception("ToySimulator") << "Unknown fanout_mode \"" << fanout_mode << "\"; expected \"copy\" or \"generate\"";  // NOLINT(cert-err60-cpp)
+	}
+
+	if (hardware_interface_->ReadoutRingEnabled() && (zero_copy_readout_ || fanout_mode_ != FanoutMode::copy))
+	{
+		throw cet::exception("ToySimulator") << "The readout ring fills its own buffers, so it cannot be combined with "  // NOLINT(cert-err60-cpp)
+		                                        "zero_copy_readout or fanout_mode \"generate\"";
+	}
+
+	if (hardware_interface_->ReadoutRingEnabled() && lazy_mode_ && lazy_batch_size_ > 0)
+	{
+		throw cet::exception("ToySimulator") << "Batched lazy_mode reads out its own triggers, so it cannot be combined with the readout ring";  // NOLINT(cert-err60-cpp)
+	}
+
+	if (hardware_interface_->ReadoutSizeVaries() && lazy_mode_ && lazy_batch_size_ > 0)
+	{
+		throw cet::exception("ToySimulator") << "Batched lazy_mode reads out a batch of triggers at one size, so it cannot be combined with a "  // NOLINT(cert-err60-cpp)
+		                                        "rate_table size_distribution";
+	}
+
+	if (rollover_subrun_interval_ > 0 && lazy_mode_ && lazy_batch_size_ > 0)
+	{
+		throw cet::exception("ToySimulator") << "Batched lazy_mode does not send EndOfSubrun Fragments, so it cannot be combined with "  // NOLINT(cert-err60-cpp)
+		                                        "rollover_subrun_interval";
+	}
+
+	if (hardware_interface_->StreamingEnabled() && (zero_copy_readout_ || fanout_mode_ != FanoutMode::copy))
+	{
+		throw cet::exception("ToySimulator") << "The streaming readout is read out by time window, so it cannot be combined with "  // NOLINT(cert-err60-cpp)
+		                                        "zero_copy_readout or fanout_mode \"generate\"";
+	}
+
+	if (!zero_copy_readout_ && fanout_mode_ == FanoutMode::copy && !hardware_interface_->ReadoutRingEnabled() && !hardware_interface_->StreamingEnabled())
+	{
+		hardware_interface_->AllocateReadoutBuffer(&readout_buffer_);
+	}
 
 	auto ts = ps.get<int>("starting_timestamp", 0);
 	if (ts < 0) { starting_timestamp_ = artdaq::Fragment::InvalidTimestamp; }
@@ -63,35 +141,267 @@ demo::ToySimulator::ToySimulator(fhicl::ParameterSet const& ps)
 		std::exit(1);
 	}
 
+	if (warm_start_)
+	{
+		hardware_interface_->WarmUp(readout_buffer_);
+	}
+
 	metadata_.board_serial_number = hardware_interface_->SerialNumber() & 0xFFFF;
 	metadata_.num_adc_bits = hardware_interface_->NumADCBits();
 	TLOG(TLVL_INFO) << "Constructor: metadata_.unused = 0x" << std::hex << metadata_.unused
 	                << " sizeof(metadata_) = " << std::dec << sizeof(metadata_);
 
-	switch (hardware_interface_->BoardType())
+	fragment_type_ = board_fragment_type(hardware_interface_->BoardType());
+
+	auto boards = ps.get<std::vector<fhicl::ParameterSet>>("boards", std::vector<fhicl::ParameterSet>());
+	if (!boards.empty())
 	{
-		case 1002:
-			fragment_type_ = toFragmentType("TOY1");
-			break;
-		case 1003:
-			fragment_type_ = toFragmentType("TOY2");
-			break;
-		default:
-			throw cet::exception("ToySimulator") << "Unable to determine board type supplied by hardware";  // NOLINT(cert-err60-cpp)
+		auto ids = fragmentIDs();
+		if (boards.size() != ids.size())
+		{
+			throw cet::exception("ToySimulator") << "\"boards\" has " << boards.size() << " entries, but there are "  // NOLINT(cert-err60-cpp)
+			                                     << ids.size() << " fragment IDs; each board reads out one of them";
+		}
+		if (lazy_mode_ || hardware_interface_->ReadoutRingEnabled() || hardware_interface_->StreamingEnabled())
+		{
+			throw cet::exception("ToySimulator") << "\"boards\" cannot be combined with lazy_mode, the readout ring or the streaming readout";  // NOLINT(cert-err60-cpp)
+		}
+
+		auto queue_depth = ps.get<size_t>("board_queue_depth", 1024);
+		for (size_t ii = 0; ii < boards.size(); ++ii)
+		{
+			boards_.emplace_back(new Board(boards[ii], ids[ii], queue_depth));
+			if (warm_start_)
+			{
+				boards_.back()->hardware->WarmUp(nullptr);
+			}
+		}
+		TLOG(TLVL_INFO) << "Will emulate " << boards_.size() << " boards, each on its own thread";
+	}
+
+	if (ps.get<bool>("rate_ramp", false))
+	{
+		if (lazy_mode_ || !boards_.empty() || hardware_interface_->ReadoutRingEnabled() || hardware_interface_->StreamingEnabled())
+		{
+			throw cet::exception("ToySimulator") << "rate_ramp paces the triggers itself, so it cannot be combined with lazy_mode, "  // NOLINT(cert-err60-cpp)
+			                                        "\"boards\", the readout ring or the streaming readout";
+		}
+
+		RateRamp::Settings settings;
+		settings.sizes_bytes = ps.get<std::vector<size_t>>("ramp_sizes_bytes", std::vector<size_t>(1, hardware_interface_->ReadoutSizeBytes()));
+		settings.start_rate_hz = ps.get<double>("ramp_start_rate_hz", 100.0);
+		settings.rate_factor = ps.get<double>("ramp_rate_factor", 1.25);
+		settings.max_rate_hz = ps.get<double>("ramp_max_rate_hz", 1000000.0);
+		settings.step = std::chrono::duration<double>(ps.get<double>("ramp_step_s", 2.0));
+		settings.rate_tolerance = ps.get<double>("ramp_rate_tolerance", 0.02);
+		settings.max_backlog = ps.get<size_t>("ramp_max_backlog", 100);
+		settings.max_latency_us = ps.get<double>("ramp_max_latency_us", 10000.0);
+		settings.max_miss_fraction = ps.get<double>("ramp_max_miss_fraction", 0.1);
+		if (settings.sizes_bytes.empty() || settings.rate_factor <= 1.0 || settings.start_rate_hz < 1.0 || settings.max_rate_hz < settings.start_rate_hz)
+		{
+			throw cet::exception("ToySimulator") << "rate_ramp needs at least one size in ramp_sizes_bytes, a ramp_rate_factor greater than 1 "  // NOLINT(cert-err60-cpp)
+			                                        "and 1 <= ramp_start_rate_hz <= ramp_max_rate_hz";
+		}
+
+		for (auto size : settings.sizes_bytes)
+		{
+			if (!hardware_interface_->FitsReadoutBuffers(size))
+			{
+				throw cet::exception("ToySimulator") << "ramp_sizes_bytes: " << size << " B readouts would not fit the readout buffers, "  // NOLINT(cert-err60-cpp)
+				                                        "which are sized for the largest size in the rate_table";
+			}
+		}
+		TLOG(TLVL_INFO) << "Will ramp the trigger rate from " << settings.start_rate_hz << " Hz, by a factor " << settings.rate_factor
+		                << " every " << settings.step.count() << " s, at " << settings.sizes_bytes.size() << " readout size(s)";
+		rate_ramp_.reset(new RateRamp(settings));
+	}
+
+	auto container_packing = ps.get<std::string>("container_packing", "none");
+	if (container_packing == "group")
+	{
+		container_packing_ = ContainerPacking::group;
+	}
+	else if (container_packing == "event")
+	{
+		container_packing_ = ContainerPacking::event;
+	}
+	else if (container_packing != "none")
+	{
+		throw cet::exception("ToySimulator") << "Unknown container_packing \"" << container_packing << "\"; expected \"none\", \"group\" or \"event\"";  // NOLINT(cert-err60-cpp)
+	}
+	if (container_packing_ != ContainerPacking::none && (lazy_mode_ || !boards_.empty() || hardware_interface_->StreamingEnabled() || rollover_subrun_interval_ > 0))
+	{
+		throw cet::exception("ToySimulator") << "container_packing cannot be combined with lazy_mode, \"boards\", the streaming readout "  // NOLINT(cert-err60-cpp)
+		                                        "or rollover_subrun_interval";
 	}
+
+	auto overrides = ps.get<std::vector<fhicl::ParameterSet>>("fragment_id_overrides", std::vector<fhicl::ParameterSet>());
+	if (!overrides.empty())
+	{
+		if ((lazy_mode_ && lazy_batch_size_ > 0) || !boards_.empty() || hardware_interface_->StreamingEnabled())
+		{
+			throw cet::exception("ToySimulator") << "fragment_id_overrides cannot be combined with lazy_batch_size, \"boards\" or the streaming readout";  // NOLINT(cert-err60-cpp)
+		}
+
+		auto ids = fragmentIDs();
+		for (auto id : ids)
+		{
+			fragment_id_overrides_.push_back(FragmentIDOverride{id, 1.0, 1, 0.0});
+		}
+		for (auto const& entry : overrides)
+		{
+			auto id = entry.get<artdaq::Fragment::fragment_id_t>("fragment_id");
+			auto it = std::find(ids.begin(), ids.end(), id);
+			if (it == ids.end())
+			{
+				throw cet::exception("ToySimulator") << "fragment_id_overrides has an entry for fragment ID " << id << ", which is not in fragment_ids";  // NOLINT(cert-err60-cpp)
+			}
+			auto& id_override = fragment_id_overrides_[std::distance(ids.begin(), it)];
+			id_override.size_scale = entry.get<double>("size_scale", 1.0);
+			id_override.prescale = entry.get<uint64_t>("prescale", 1);
+			id_override.missing_fraction = entry.get<double>("missing_fraction", 0.0);
+			if (id_override.size_scale < 0.0 || id_override.prescale == 0 || id_override.missing_fraction < 0.0 || id_override.missing_fraction > 1.0)
+			{
+				throw cet::exception("ToySimulator") << "fragment_id_overrides entry for fragment ID " << id << " needs size_scale >= 0, "  // NOLINT(cert-err60-cpp)
+				                                     << "prescale >= 1 and 0 <= missing_fraction <= 1";
+			}
+			if (id_override.size_scale != 1.0 && fanout_mode_ != FanoutMode::generate)
+			{
+				throw cet::exception("ToySimulator") << "fragment_id_overrides size_scale needs fanout_mode \"generate\", "  // NOLINT(cert-err60-cpp)
+				                                        "as \"copy\" gives every fragment ID the same readout";
+			}
+			if (id_override.size_scale > 1.0 && hardware_interface_->PatternBankEnabled())
+			{
+				throw cet::exception("ToySimulator") << "fragment_id_overrides size_scale can't be more than 1 with a pattern_bank_size, "  // NOLINT(cert-err60-cpp)
+				                                        "as the patterns only cover the largest readout";
+			}
+		}
+		TLOG(TLVL_INFO) << "Will override the size or rate of " << overrides.size() << " of " << ids.size() << " fragment IDs";
+	}
+
+	DeliveryPerturbation::Settings delivery;
+	delivery.reorder_window = ps.get<size_t>("delivery_reorder_window", 0);
+	delivery.jitter = std::chrono::microseconds(ps.get<int64_t>("delivery_jitter_us", 0));
+	delivery.late_fraction = ps.get<double>("delivery_late_fraction", 0.0);
+	delivery.late_delay = std::chrono::microseconds(ps.get<int64_t>("delivery_late_us", 0));
+	delivery.seed = ps.get<int64_t>("random_seed", 314159);
+	if (delivery.jitter.count() < 0 || delivery.late_delay.count() < 0 || delivery.late_fraction < 0.0 || delivery.late_fraction > 1.0)
+	{
+		throw cet::exception("ToySimulator") << "The delivery perturbation needs delivery_jitter_us >= 0, delivery_late_us >= 0 "  // NOLINT(cert-err60-cpp)
+		                                        "and 0 <= delivery_late_fraction <= 1";
+	}
+	if (delivery.reorder_window > 0 || delivery.jitter.count() > 0 || (delivery.late_fraction > 0.0 && delivery.late_delay.count() > 0))
+	{
+		TLOG(TLVL_INFO) << "Will perturb the delivery: reorder window " << delivery.reorder_window << " Fragments, jitter " << delivery.jitter.count()
+		                << " us, " << delivery.late_fraction << " of the Fragments " << delivery.late_delay.count() << " us late";
+		delivery_perturbation_.reset(new DeliveryPerturbation(delivery));
+	}
+
+	auto pool_depth = ps.get<size_t>("fragment_pool_depth", 0);
+	if (pool_depth > 0 && boards_.empty() && !hardware_interface_->StreamingEnabled())
+	{
+		TLOG(TLVL_INFO) << "Will keep " << pool_depth << " Fragments ready per size class in use";
+		fragment_pool_.reset(new FragmentPool<ToyFragment::Metadata>(pool_depth, std::chrono::microseconds(ps.get<size_t>("fragment_pool_refill_us", 100)),
+		                                                             fragment_type_, metadata_, hardware_interface_->ReadoutSizeBytes()));
+	}
+
+	prepare_warm_fragments_();
 }
 
-demo::ToySimulator::~ToySimulator() { hardware_interface_->FreeReadoutBuffer(readout_buffer_); }
+demo::ToySimulator::Board::Board(fhicl::ParameterSet const& ps, artdaq::Fragment::fragment_id_t id, size_t queue_depth)
+    : hardware(new ToyHardwareInterface(ps))
+    , fragment_id(id)
+    , cpu(ps.get<int>("cpu", -1))
+    , fragment_type(board_fragment_type(hardware->BoardType()))
+    , metadata({0, 0, 0})
+    , running(false)
+    , failed(false)
+    , stalls(0)
+    , queue(queue_depth)
+    , delivered(0)
+{
+	if (hardware->ReadoutRingEnabled() || hardware->StreamingEnabled())
+	{
+		throw cet::exception("ToySimulator") << "Board " << id << " cannot use the readout ring or the streaming readout; "  // NOLINT(cert-err60-cpp)
+		                                        "its worker thread already reads it out asynchronously";
+	}
+	metadata.board_serial_number = hardware->SerialNumber() & 0xFFFF;
+	metadata.num_adc_bits = hardware->NumADCBits();
+}
+
+demo::ToySimulator::~ToySimulator()
+{
+	stop_boards_();
+	if (readout_buffer_ != nullptr)
+	{
+		hardware_interface_->FreeReadoutBuffer(readout_buffer_);
+	}
+}
 
 bool demo::ToySimulator::getNext_(artdaq::FragmentPtrs& frags)
+{
+	auto more = read_out_(frags);
+	if (delivery_perturbation_ != nullptr)
+	{
+		perturb_delivery_(frags, more);
+	}
+
+	if (awaiting_first_fragment_ && !frags.empty())
+	{
+		awaiting_first_fragment_ = false;
+		auto latency = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_transition_time_).count();
+		TLOG(TLVL_INFO) << "First Fragment of the run sent " << latency * 1000.0 << " ms after the start transition";
+		if (metricMan != nullptr)
+		{
+			metricMan->sendMetric("Start To First Fragment", latency, "s", 3, artdaq::MetricMode::LastPoint);
+		}
+	}
+	return more;
+}
+
+bool demo::ToySimulator::read_out_(artdaq::FragmentPtrs& frags)
 {
 	if (should_stop())
 	{
 		return false;
 	}
 
+	if (bind_readout_thread_)
+	{
+		// getNext_ runs on the BoardReader's data thread, not the one which called start()
+		hardware_interface_->BindReadoutThread();
+		bind_readout_thread_ = false;
+	}
+
+	if (!boards_.empty())
+	{
+		return merge_boards_(frags);
+	}
+
+	if (hardware_interface_->StreamingEnabled())
+	{
+		return serve_window_requests_(frags);
+	}
+
+	if (lazy_mode_ && lazy_batch_size_ > 0)
+	{
+		return serve_request_batch_(frags);
+	}
+
 	auto start = std::chrono::steady_clock::now();
 
+	// Hot-path stage timing; the clock is only read when it is enabled
+	bool const timing = stage_metrics_interval_.count() > 0;
+	auto stage_clock = [timing]() { return timing ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point(); };
+	auto record_fill = [&](std::chrono::steady_clock::time_point fill_begin, uint64_t bytes) {
+		if (timing)
+		{
+			auto wait = hardware_interface_->LastTriggerWait();
+			pacing_wait_timer_.Record(wait);
+			fill_timer_.Record(std::chrono::steady_clock::now() - fill_begin - wait, bytes);
+		}
+	};
+
 	// ToyHardwareInterface (an instance to which "hardware_interface_"
 	// is a unique_ptr object) is just one example of the sort of
 	// interface a hardware library might offer. For example, other
@@ -103,8 +413,18 @@ bool demo::ToySimulator::getNext_(artdaq::FragmentPtrs& frags)
 	// rather than sticking the data in the location pointed to by your
 	// pointer (which is what happens here with readout_buffer_)
 
-	while (frags.size() < fragment_group_size_ * fragmentIDs().size() && std::chrono::steady_clock::now() - start < fragment_group_timeout_)
+	// Beyond the fragment group, read out in one batch every trigger which
+	// has already come due
+	size_t events = 0;
+	size_t fragments_missing = 0;  // Left out by fragment_id_overrides, but part of the group all the same
+	auto more_events = [&]() {
+		return frags.size() + fragments_missing < fragment_group_size_ * fragmentIDs().size() || (events < max_trigger_batch_ && hardware_interface_->PendingTriggers() > 0);
+	};
+
+	while (more_events() && std::chrono::steady_clock::now() - start < fragment_group_timeout_)
 	{
+		++events;
+
 		// 15-Nov-2019, KAB, JCF: added handling of the 'lazy' mode.
 		// In this context, "lazy" is intended to mean "only generate data when
 		// it is requested".  With this code, we return before doing the work
@@ -145,9 +465,8 @@ bool demo::ToySimulator::getNext_(artdaq::FragmentPtrs& frags)
 			TLOG(52) << "Looping through " << requests.size() << " requests to see if there is a new one.";
 			while (request_iterator != requests.end())
 			{
-				if (lazily_handled_requests_.find(request_iterator->first) == lazily_handled_requests_.end())
+				if (lazily_handled_requests_.Insert(request_iterator->first))
 				{
-					lazily_handled_requests_.insert(request_iterator->first);
 					new_request = *request_iterator;
 					break;
 				}
@@ -164,11 +483,6 @@ bool demo::ToySimulator::getNext_(artdaq::FragmentPtrs& frags)
 #endif
 		}
 
-		TLOG(TLVL_DEBUG + 3) << "getNext_: Calling ToyHardwareInterface::FillBuffer";
-		std::size_t bytes_read = 0;
-		hardware_interface_->FillBuffer(readout_buffer_, &bytes_read);
-		TLOG(TLVL_DEBUG + 3) << "getNext_: Done with FillBuffer";
-
 		// We'll use the static factory function
 
 		// artdaq::Fragment::FragmentBytes(std::size_t payload_size_in_bytes, sequence_id_t sequence_id,
@@ -177,32 +491,184 @@ bool demo::ToySimulator::getNext_(artdaq::FragmentPtrs& frags)
 		// which will then return a unique_ptr to an artdaq::Fragment
 		// object.
 
-		TLOG(TLVL_DEBUG + 3) << "getNext_: Creating Fragments for configured Fragment IDs";
-		for (auto& id : fragmentIDs())
+		std::size_t bytes_read = 0;
+		char const* readout = readout_buffer_;
+		char* ring_buffer = nullptr;
+		auto zero_copy_fragment = frags.end();
+
+		if (hardware_interface_->ReadoutRingEnabled())
+		{
+			// The hardware has been filling buffers on its own clock; just pick up
+			// the oldest one, and hand it back as soon as it has been copied
+			TLOG(TLVL_DEBUG + 3) << "getNext_: Waiting for a buffer from the readout ring";
+			auto wait_begin = stage_clock();
+			while (!hardware_interface_->WaitForReadout(&ring_buffer, &bytes_read, 100000))
+			{
+				if (should_stop())
+				{
+					return true;
+				}
+			}
+			readout = ring_buffer;
+			if (timing)
+			{
+				pacing_wait_timer_.Record(std::chrono::steady_clock::now() - wait_begin);
+			}
+			TLOG(TLVL_DEBUG + 3) << "getNext_: Got a " << bytes_read << " byte buffer from the readout ring";
+		}
+		else if (fanout_mode_ == FanoutMode::generate)
 		{
-			// The offset logic below is designed to both ensure
-			// backwards compatibility and to (help) avoid collisions
-			// with fragment_ids from other boardreaders if more than
-			// one fragment is generated per event
+			// One readout, one Fragment per fragment ID, each filled in place by the
+			// hardware interface from its own random stream (and at its own size):
+			// no copies at all
+			auto ids = fragmentIDs();
+			fanout_buffers_.clear();
+			fanout_scales_.clear();
+			fanout_ids_.clear();
+			size_t fanout_bytes = 0;
+			auto allocate_begin = stage_clock();
+			for (size_t ii = 0; ii < ids.size(); ++ii)
+			{
+				if (!fragment_present_(ii, ev_counter()))
+				{
+					++fragments_missing;
+					continue;
+				}
+				auto scale = fragment_id_overrides_.empty() ? 1.0 : fragment_id_overrides_[ii].size_scale;
+				auto size = hardware_interface_->ReadoutSizeBytes(scale);
+				frags.emplace_back(make_fragment_(size, ev_counter(), ids[ii], timestamp_));
+				fanout_buffers_.push_back(reinterpret_cast<char*>(frags.back()->dataBeginBytes()));  // NOLINT(cppcoreguidelines-pro-type-reinterpret-cast)
+				fanout_scales_.push_back(scale);
+				fanout_ids_.push_back(ids[ii]);
+				fanout_bytes += size;
+			}
+			if (timing)
+			{
+				allocate_timer_.Record(std::chrono::steady_clock::now() - allocate_begin);
+			}
 
-			std::unique_ptr<artdaq::Fragment> fragptr(
-			    artdaq::Fragment::FragmentBytes(bytes_read, ev_counter(), id, fragment_type_, metadata_, timestamp_));
-			frags.emplace_back(std::move(fragptr));
+			TLOG(TLVL_DEBUG + 3) << "getNext_: Calling ToyHardwareInterface::FillBuffers for " << fanout_buffers_.size() << " Fragments";
+			auto fill_begin = stage_clock();
+			hardware_interface_->FillBuffers(fanout_buffers_.data(), fanout_buffers_.size(), fanout_scales_.data(), &bytes_read, ev_counter(), fanout_ids_.data());
+			record_fill(fill_begin, fanout_bytes);
+			TLOG(TLVL_DEBUG + 3) << "getNext_: Done with FillBuffers";
 
-			TLOG(TLVL_DEBUG + 4) << "getNext_: Before memcpy";
-			if (distribution_type_ != ToyHardwareInterface::DistributionType::uninitialized)
+			if (metricMan != nullptr)
 			{
-				memcpy(frags.back()->dataBeginBytes(), readout_buffer_, bytes_read);
+				metricMan->sendMetric("Readout Copy Bytes Saved", fanout_bytes, "Bytes", 3, artdaq::MetricMode::Rate);
 			}
-			else
+		}
+		else if (zero_copy_readout_)
+		{
+			// Allocate the Fragment for the first fragment ID up front and let the
+			// hardware interface fill its payload in place, which saves a full
+			// pass over the data compared to filling readout_buffer_ and copying
+			auto allocate_begin = stage_clock();
+			frags.emplace_back(make_fragment_(hardware_interface_->ReadoutSizeBytes(), ev_counter(), fragmentIDs().front(), timestamp_));
+			zero_copy_fragment = std::prev(frags.end());
+			if (timing)
 			{
-				// Must preserve the Header!
-				memcpy(frags.back()->dataBeginBytes(), readout_buffer_, sizeof(ToyFragment::Header));
+				allocate_timer_.Record(std::chrono::steady_clock::now() - allocate_begin);
 			}
 
-			TLOG(TLVL_DEBUG + 4) << "getNext_ after memcpy " << bytes_read
-			                     << " bytes and std::move dataSizeBytes()=" << frags.back()->sizeBytes()
-			                     << " metabytes=" << sizeof(metadata_);
+			TLOG(TLVL_DEBUG + 3) << "getNext_: Calling ToyHardwareInterface::FillBuffer on the Fragment payload";
+			readout = reinterpret_cast<char const*>(frags.back()->dataBeginBytes());  // NOLINT(cppcoreguidelines-pro-type-reinterpret-cast)
+			auto fill_begin = stage_clock();
+			hardware_interface_->FillBuffer(reinterpret_cast<char*>(frags.back()->dataBeginBytes()), &bytes_read, ev_counter(), fragment_id());  // NOLINT(cppcoreguidelines-pro-type-reinterpret-cast)
+			record_fill(fill_begin, bytes_read);
+			TLOG(TLVL_DEBUG + 3) << "getNext_: Done with FillBuffer";
+
+			if (metricMan != nullptr)
+			{
+				metricMan->sendMetric("Readout Copy Bytes Saved", bytes_read, "Bytes", 3, artdaq::MetricMode::Rate);
+			}
+		}
+		else
+		{
+			TLOG(TLVL_DEBUG + 3) << "getNext_: Calling ToyHardwareInterface::FillBuffer";
+			auto fill_begin = stage_clock();
+			hardware_interface_->FillBuffer(readout_buffer_, &bytes_read, ev_counter(), fragment_id());
+			record_fill(fill_begin, bytes_read);
+			TLOG(TLVL_DEBUG + 3) << "getNext_: Done with FillBuffer";
+		}
+
+		if (rate_ramp_ != nullptr)
+		{
+			rate_ramp_->RecordReadout(hardware_interface_->LastTriggerLateness());
+		}
+
+		if (fanout_mode_ == FanoutMode::copy)
+		{
+			TLOG(TLVL_DEBUG + 3) << "getNext_: Creating Fragments for configured Fragment IDs";
+			auto ids = fragmentIDs();
+			for (size_t ii = 0; ii < ids.size(); ++ii)
+			{
+				auto id = ids[ii];
+				if (zero_copy_readout_ && ii == 0)
+				{
+					// Already created and filled above
+					continue;
+				}
+				if (!fragment_present_(ii, ev_counter()))
+				{
+					++fragments_missing;
+					continue;
+				}
+
+				// The offset logic below is designed to both ensure
+				// backwards compatibility and to (help) avoid collisions
+				// with fragment_ids from other boardreaders if more than
+				// one fragment is generated per event
+
+				auto allocate_begin = stage_clock();
+				std::unique_ptr<artdaq::Fragment> fragptr(make_fragment_(bytes_read, ev_counter(), id, timestamp_));
+				frags.emplace_back(std::move(fragptr));
+
+				TLOG(TLVL_DEBUG + 4) << "getNext_: Before memcpy";
+				auto copy_begin = stage_clock();
+				size_t copy_bytes = bytes_read;
+				if (distribution_type_ != ToyHardwareInterface::DistributionType::uninitialized)
+				{
+					memcpy(frags.back()->dataBeginBytes(), readout, bytes_read);
+				}
+				else
+				{
+					// Must preserve the Header!
+					copy_bytes = sizeof(ToyFragment::Header);
+					memcpy(frags.back()->dataBeginBytes(), readout, copy_bytes);
+				}
+				if (timing)
+				{
+					auto copy_end = std::chrono::steady_clock::now();
+					allocate_timer_.Record(copy_begin - allocate_begin);
+					copy_timer_.Record(copy_end - copy_begin, copy_bytes);
+				}
+
+				TLOG(TLVL_DEBUG + 4) << "getNext_ after memcpy " << bytes_read
+				                     << " bytes and std::move dataSizeBytes()=" << frags.back()->sizeBytes()
+				                     << " metabytes=" << sizeof(metadata_);
+			}
+
+			// The zero-copy Fragment had to be read out for the others, even if
+			// its own fragment ID is left out of this event
+			if (zero_copy_fragment != frags.end() && !fragment_present_(0, ev_counter()))
+			{
+				frags.erase(zero_copy_fragment);
+				++fragments_missing;
+			}
+		}
+
+		if (ring_buffer != nullptr)
+		{
+			hardware_interface_->FreeReadoutBuffer(ring_buffer);
+
+			if (metricMan != nullptr)
+			{
+				auto stats = hardware_interface_->GetReadoutRingStatistics();
+				metricMan->sendMetric("Readout Ring Overflows", stats.overflows, "Triggers", 3, artdaq::MetricMode::LastPoint);
+				metricMan->sendMetric("Readout Ring Busy Time", stats.busy_seconds, "s", 3, artdaq::MetricMode::LastPoint);
+				metricMan->sendMetric("Readout Ring Occupancy", stats.buffers_filled, "Buffers", 3, artdaq::MetricMode::Average);
+			}
 		}
 
 		if (metricMan != nullptr)
@@ -213,6 +679,7 @@ bool demo::ToySimulator::getNext_(artdaq::FragmentPtrs& frags)
 		TLOG(TLVL_DEBUG + 3) << "getNext_: Checking for subrun rollover";
 		if (rollover_subrun_interval_ > 0 && ev_counter() % rollover_subrun_interval_ == 0 && fragment_id() == 0)
 		{
+			auto rollover_begin = stage_clock();
 			bool fragmentIdZero = false;
 			for (auto& id : fragmentIDs())
 			{
@@ -233,27 +700,612 @@ bool demo::ToySimulator::getNext_(artdaq::FragmentPtrs& frags)
 				*endOfSubrunFrag->dataBegin() = my_rank;
 				frags.emplace_back(std::move(endOfSubrunFrag));
 			}
+			if (timing)
+			{
+				rollover_timer_.Record(std::chrono::steady_clock::now() - rollover_begin);
+			}
 		}
 
 		ev_counter_inc(sequence_id_scale_);
 		timestamp_ += timestampScale_;
 	}
+
+	if (metricMan != nullptr && !fragment_id_overrides_.empty())
+	{
+		metricMan->sendMetric("Fragments Missing", fragments_missing, "Fragments", 3, artdaq::MetricMode::Rate);
+	}
+	if (timing && std::chrono::steady_clock::now() - last_stage_metrics_ >= stage_metrics_interval_)
+	{
+		send_stage_metrics_();
+	}
+	if (container_packing_ != ContainerPacking::none && !frags.empty())
+	{
+		pack_containers_(frags);
+	}
 	TLOG(TLVL_DEBUG + 3) << "getNext_: DONE";
-	return true;
+	return rate_ramp_ == nullptr || step_rate_ramp_();
+}
+
+void demo::ToySimulator::perturb_delivery_(artdaq::FragmentPtrs& frags, bool more)
+{
+	delivery_perturbation_->Process(frags, std::chrono::steady_clock::now());
+	if (!more)
+	{
+		delivery_perturbation_->Flush(frags);
+	}
+
+	auto stats = delivery_perturbation_->TakeStatistics();
+	if (metricMan != nullptr)
+	{
+		metricMan->sendMetric("Delivery Held Fragments", stats.held, "Fragments", 3, artdaq::MetricMode::Average);
+		metricMan->sendMetric("Delivery Out Of Order Fragments", stats.out_of_order, "Fragments", 3, artdaq::MetricMode::Rate);
+		metricMan->sendMetric("Delivery Late Fragments", stats.late, "Fragments", 3, artdaq::MetricMode::Rate);
+	}
+}
+
+// Prescaling keeps whole sequence IDs, so that every fragment ID with the
+// same prescale is sent for the same events; missing Fragments are drawn
+// per fragment ID, from a stream of their own
+
+bool demo::ToySimulator::fragment_present_(size_t index, artdaq::Fragment::sequence_id_t sequence_id) const
+{
+	if (fragment_id_overrides_.empty())
+	{
+		return true;
+	}
+	auto const& id_override = fragment_id_overrides_[index];
+	if (sequence_id % id_override.prescale != 0)
+	{
+		return false;
+	}
+	if (id_override.missing_fraction <= 0.0)
+	{
+		return true;
+	}
+	auto bits = SplitMixStream{SplitMixStream{missing_key_}(id_override.fragment_id)}(sequence_id);
+	return static_cast<double>(bits >> 11) * 0x1.0p-53 >= id_override.missing_fraction;
 }
 
 void demo::ToySimulator::start()
 {
+	start_transition_time_ = std::chrono::steady_clock::now();
+	awaiting_first_fragment_ = true;
 	hardware_interface_->StartDatataking();
 	while (ev_counter() < initial_sequence_id_)
 	{
 		ev_counter_inc();
 	}
 	timestamp_ = starting_timestamp_;
-	lazily_handled_requests_.clear();
+	lazily_handled_requests_.Reset();
+	streaming_windows_lost_ = 0;
+	last_stage_metrics_ = std::chrono::steady_clock::now();
+	last_page_faults_ = ReadoutMemory::GetPageFaults();
+	bind_readout_thread_ = true;
+	if (rate_ramp_ != nullptr)
+	{
+		rate_ramp_->Start(std::chrono::steady_clock::now());
+		hardware_interface_->SetRate(rate_ramp_->SizeBytes(), rate_ramp_->RateHz());
+	}
+	start_boards_();
+}
+
+// The Fragments for the first events of a run are allocated, and their
+// pages faulted in, at configure and at stop, so that start() stays quick
+
+void demo::ToySimulator::prepare_warm_fragments_()
+{
+	if (!warm_start_ || !boards_.empty() || hardware_interface_->StreamingEnabled())
+	{
+		return;
+	}
+
+	// With a size_distribution, the first events may be larger than any one
+	// draw, so cover the largest, lest make_fragment_ reallocate them
+	auto readout_size = hardware_interface_->FirstReadoutMaxBytes();
+	auto count = std::max(fragment_group_size_, lazy_batch_size_) * fragmentIDs().size();
+	while (warm_fragments_.size() < count)
+	{
+		warm_fragments_.emplace_back(artdaq::Fragment::FragmentBytes(readout_size, 0, 0, fragment_type_, metadata_, 0));
+		ReadoutMemory::Prefault(reinterpret_cast<char*>(warm_fragments_.back()->dataBeginBytes()), readout_size);  // NOLINT(cppcoreguidelines-pro-type-reinterpret-cast)
+	}
+}
+
+artdaq::FragmentPtr demo::ToySimulator::make_fragment_(size_t bytes, artdaq::Fragment::sequence_id_t sequence_id, artdaq::Fragment::fragment_id_t fragment_id, artdaq::Fragment::timestamp_t timestamp)
+{
+	artdaq::FragmentPtr fragment;
+	if (!warm_fragments_.empty())
+	{
+		fragment = std::move(warm_fragments_.back());
+		warm_fragments_.pop_back();
+		fragment->resizeBytes(bytes);
+	}
+	else if (fragment_pool_ != nullptr)
+	{
+		fragment = fragment_pool_->Take(bytes);
+	}
+	if (fragment == nullptr)
+	{
+		++fragment_allocations_;
+		return artdaq::Fragment::FragmentBytes(bytes, sequence_id, fragment_id, fragment_type_, metadata_, timestamp);
+	}
+
+	fragment->setSequenceID(sequence_id);
+	fragment->setFragmentID(fragment_id);
+	fragment->setTimestamp(timestamp);
+	return fragment;
+}
+
+void demo::ToySimulator::stop()
+{
+	stop_boards_();
+	hardware_interface_->StopDatataking();
+	if (delivery_perturbation_ != nullptr)
+	{
+		auto dropped = delivery_perturbation_->Clear();
+		if (dropped > 0)
+		{
+			TLOG(TLVL_WARNING) << "stop: Dropping " << dropped << " Fragments still held back by the delivery perturbation";
+		}
+		if (metricMan != nullptr)
+		{
+			metricMan->sendMetric("Delivery Dropped Fragments", dropped, "Fragments", 3, artdaq::MetricMode::LastPoint);
+		}
+	}
+	prepare_warm_fragments_();
+}
+
+void demo::ToySimulator::start_boards_()
+{
+	for (auto& board : boards_)
+	{
+		board->queue.Clear();
+		board->running = true;
+		board->failed = false;
+		board->exception = nullptr;
+		board->stalls = 0;
+		board->delivered = ev_counter();
+		board->hardware->StartDatataking();
+		board->thread = std::thread(&ToySimulator::board_loop_, this, std::ref(*board), ev_counter());
+
+		if (board->cpu >= 0)
+		{
+			cpu_set_t cpus;
+			CPU_ZERO(&cpus);
+			CPU_SET(board->cpu, &cpus);
+			auto rc = pthread_setaffinity_np(board->thread.native_handle(), sizeof(cpus), &cpus);
+			if (rc != 0)
+			{
+				TLOG(TLVL_WARNING) << "Could not pin board " << board->fragment_id << " to CPU " << board->cpu << ": " << strerror(rc);
+			}
+		}
+	}
+}
+
+void demo::ToySimulator::stop_boards_()
+{
+	for (auto& board : boards_)
+	{
+		board->running = false;
+	}
+	for (auto& board : boards_)
+	{
+		if (board->thread.joinable())
+		{
+			board->thread.join();
+		}
+		board->hardware->StopDatataking();
+	}
+}
+
+// Each board thread is the whole readout chain of one board: it waits for
+// the board's triggers, has it fill a Fragment in place, and hands the
+// Fragment over through the board's queue. A full queue holds the board
+// back (counted as a stall) rather than dropping data, so that every event
+// stays complete.
+
+void demo::ToySimulator::board_loop_(Board& board, artdaq::Fragment::sequence_id_t sequence_id)
+{
+	auto timestamp = starting_timestamp_;
+	if (board.cpu < 0)
+	{
+		board.hardware->BindReadoutThread();
+	}
+	try
+	{
+		while (board.running.load(std::memory_order_acquire))
+		{
+			artdaq::FragmentPtr fragment(artdaq::Fragment::FragmentBytes(board.hardware->ReadoutSizeBytes(), sequence_id, board.fragment_id, board.fragment_type, board.metadata, timestamp));
+			size_t bytes_read = 0;
+			board.hardware->FillBuffer(reinterpret_cast<char*>(fragment->dataBeginBytes()), &bytes_read, sequence_id, board.fragment_id);  // NOLINT(cppcoreguidelines-pro-type-reinterpret-cast)
+
+			if (!board.queue.Push(std::move(fragment)))
+			{
+				board.stalls.fetch_add(1, std::memory_order_relaxed);
+				while (!board.queue.Push(std::move(fragment)))
+				{
+					if (!board.running.load(std::memory_order_acquire))
+					{
+						return;
+					}
+					usleep(10);
+				}
+			}
+
+			sequence_id += sequence_id_scale_;
+			timestamp += timestampScale_;
+		}
+	}
+	catch (...)
+	{
+		TLOG(TLVL_ERROR) << "Board " << board.fragment_id << " caught an exception, it will be rethrown by getNext_";
+		board.exception = std::current_exception();
+		board.failed.store(true, std::memory_order_release);
+	}
+}
+
+bool demo::ToySimulator::merge_boards_(artdaq::FragmentPtrs& frags)
+{
+	// Take the boards' Fragments in turn until fragment_group_size events'
+	// worth have been collected, or the group times out
+	auto start = std::chrono::steady_clock::now();
+	auto wanted = fragment_group_size_ * boards_.size();
+	size_t taken = 0;
+	while (taken < wanted && std::chrono::steady_clock::now() - start < fragment_group_timeout_)
+	{
+		bool any = false;
+		for (auto& board : boards_)
+		{
+			if (board->failed.load(std::memory_order_acquire))
+			{
+				std::rethrow_exception(board->exception);
+			}
+
+			artdaq::FragmentPtr fragment;
+			if (board->queue.Pop(fragment))
+			{
+				board->delivered = fragment->sequenceID() + sequence_id_scale_;
+				frags.emplace_back(std::move(fragment));
+				++taken;
+				any = true;
+			}
+		}
+		if (!any)
+		{
+			if (should_stop())
+			{
+				break;
+			}
+			usleep(10);
+		}
+	}
+
+	// An event is complete once every board has delivered its Fragment
+	auto complete = boards_.front()->delivered;
+	for (auto& board : boards_)
+	{
+		complete = std::min(complete, board->delivered);
+	}
+	while (ev_counter() < complete)
+	{
+		ev_counter_inc(sequence_id_scale_);
+	}
+
+	if (metricMan != nullptr)
+	{
+		size_t queued = 0;
+		size_t stalls = 0;
+		for (auto& board : boards_)
+		{
+			queued = std::max(queued, board->queue.Size());
+			stalls += board->stalls.load(std::memory_order_relaxed);
+		}
+		metricMan->sendMetric("Board Queue Occupancy", queued, "Fragments", 3, artdaq::MetricMode::Average);
+		metricMan->sendMetric("Board Queue Stalls", stalls, "Fragments", 3, artdaq::MetricMode::LastPoint);
+		metricMan->sendMetric("Fragments Sent", ev_counter(), "Events", 3, artdaq::MetricMode::LastPoint);
+	}
+	return true;
+}
+
+// The Fragments are moved, not copied, into their group's list; the loader
+// then sizes each container once for all of its Fragments
+
+void demo::ToySimulator::pack_containers_(artdaq::FragmentPtrs& frags)
+{
+	for (auto& container : containers_)
+	{
+		container.second.clear();
+	}
+	size_t used = 0;
+	while (!frags.empty())
+	{
+		auto key = container_packing_ == ContainerPacking::group ? frags.front()->fragmentID() : frags.front()->sequenceID();
+		auto container = std::find_if(containers_.begin(), containers_.begin() + used, [key](auto const& entry) { return entry.first == key; });
+		if (container == containers_.begin() + used)
+		{
+			if (used == containers_.size())
+			{
+				containers_.emplace_back();
+			}
+			container = containers_.begin() + used++;
+			container->first = key;
+		}
+		container->second.splice(container->second.end(), frags, frags.begin());
+	}
+
+	for (size_t ii = 0; ii < used; ++ii)
+	{
+		auto& contents = containers_[ii].second;
+		auto const& first = *contents.front();
+		artdaq::FragmentPtr container(new artdaq::Fragment(first.sequenceID(), first.fragmentID(), artdaq::Fragment::ContainerFragmentType, first.timestamp()));
+		artdaq::ContainerFragmentLoader loader(*container, fragment_type_);
+		loader.addFragments(contents);
+		if (metricMan != nullptr)
+		{
+			metricMan->sendMetric("Fragments Per Container", contents.size(), "Fragments", 3, artdaq::MetricMode::Average);
+		}
+		contents.clear();
+		frags.emplace_back(std::move(container));
+	}
+}
+
+// Each SetRate restarts the trigger clock, so a step's backlog and latency
+// are its own and not left over from a previous, faster step
+
+bool demo::ToySimulator::step_rate_ramp_()
+{
+	auto now = std::chrono::steady_clock::now();
+	if (!rate_ramp_->Running() || !rate_ramp_->StepDone(now))
+	{
+		return rate_ramp_->Running();
+	}
+
+	auto step = rate_ramp_->EndStep(now, hardware_interface_->PendingTriggers());
+	TLOG(TLVL_INFO) << "Rate ramp: " << step.size_bytes << " B at " << step.target_rate_hz << " Hz is " << (step.stable ? "stable" : "NOT stable")
+	                << ": achieved " << step.achieved_rate_hz << " Hz, " << step.backlog << " triggers backlog, P99 latency "
+	                << step.latency_p99_us << " us, " << 100.0 * step.miss_fraction << "% of triggers read out late";
+	if (metricMan != nullptr)
+	{
+		metricMan->sendMetric("Ramp Rate", step.target_rate_hz, "Hz", 3, artdaq::MetricMode::LastPoint);
+		metricMan->sendMetric("Ramp Achieved Rate", step.achieved_rate_hz, "Hz", 3, artdaq::MetricMode::LastPoint);
+		metricMan->sendMetric("Ramp Size", step.size_bytes, "Bytes", 3, artdaq::MetricMode::LastPoint);
+		metricMan->sendMetric("Ramp Trigger Latency P99", step.latency_p99_us, "us", 3, artdaq::MetricMode::LastPoint);
+	}
+
+	if (rate_ramp_->Running())
+	{
+		hardware_interface_->SetRate(rate_ramp_->SizeBytes(), rate_ramp_->RateHz());
+		return true;
+	}
+
+	for (auto& result : rate_ramp_->Results())
+	{
+		TLOG(TLVL_INFO) << "Rate ramp result: " << result.size_bytes << " B Fragments are stable up to " << result.max_stable_rate_hz << " Hz ("
+		                << result.ThroughputBytesPerSecond() / 1e6 << " MB/s)" << (result.limited ? "" : ", the highest rate tried");
+	}
+	auto best = rate_ramp_->Best();
+	TLOG(TLVL_INFO) << "Rate ramp done: the highest stable throughput is " << best.ThroughputBytesPerSecond() / 1e6 << " MB/s, with "
+	                << best.size_bytes << " B Fragments at " << best.max_stable_rate_hz << " Hz";
+	if (metricMan != nullptr)
+	{
+		metricMan->sendMetric("Ramp Max Stable Rate", best.max_stable_rate_hz, "Hz", 3, artdaq::MetricMode::LastPoint);
+		metricMan->sendMetric("Ramp Max Stable Throughput", best.ThroughputBytesPerSecond(), "Bytes/s", 3, artdaq::MetricMode::LastPoint);
+	}
+	return false;
 }
 
-void demo::ToySimulator::stop() { hardware_interface_->StopDatataking(); }
+bool demo::ToySimulator::serve_request_batch_(artdaq::FragmentPtrs& frags)
+{
+	// Take every request which hasn't been served yet (up to lazy_batch_size_)
+	// in one go, rather than one per call
+	request_batch_.clear();
+	for (auto& request : GetRequests())
+	{
+		if (request_batch_.size() == lazy_batch_size_)
+		{
+			break;
+		}
+		if (lazily_handled_requests_.Insert(request.first))
+		{
+			request_batch_.push_back(request);
+		}
+	}
+	if (request_batch_.empty())
+	{
+		usleep(10);
+		return true;
+	}
+	TLOG(TLVL_DEBUG + 3) << "serve_request_batch_: Serving " << request_batch_.size() << " requests, starting with sequence ID "
+	                     << request_batch_.front().first;
+
+	// Allocate the Fragments for the whole batch, then have the hardware
+	// interface fill them all in place in a single pass
+	bool const timing = stage_metrics_interval_.count() > 0;
+	auto allocate_begin = timing ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point();
+	auto ids = fragmentIDs();
+	auto readout_size = hardware_interface_->ReadoutSizeBytes();
+	fanout_buffers_.clear();
+	batch_sequence_ids_.clear();
+	for (auto& request : request_batch_)
+	{
+		batch_sequence_ids_.push_back(request.first);
+		for (auto& id : ids)
+		{
+			frags.emplace_back(make_fragment_(readout_size, request.first, id, request.second));
+			fanout_buffers_.push_back(reinterpret_cast<char*>(frags.back()->dataBeginBytes()));  // NOLINT(cppcoreguidelines-pro-type-reinterpret-cast)
+		}
+	}
+
+	auto fill_begin = timing ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point();
+	size_t bytes_read = 0;
+	hardware_interface_->FillBatch(fanout_buffers_.data(), request_batch_.size(), ids.size(), &bytes_read, batch_sequence_ids_.data(), ids.data());
+
+	if (timing)
+	{
+		auto wait = hardware_interface_->LastTriggerWait();
+		allocate_timer_.Record(fill_begin - allocate_begin);
+		pacing_wait_timer_.Record(wait);
+		fill_timer_.Record(std::chrono::steady_clock::now() - fill_begin - wait, bytes_read * fanout_buffers_.size());
+		if (std::chrono::steady_clock::now() - last_stage_metrics_ >= stage_metrics_interval_)
+		{
+			send_stage_metrics_();
+		}
+	}
+
+	for (size_t ii = 0; ii < request_batch_.size(); ++ii)
+	{
+		ev_counter_inc(sequence_id_scale_);
+	}
+	timestamp_ = request_batch_.back().second + timestampScale_;
+
+	if (metricMan != nullptr)
+	{
+		metricMan->sendMetric("Request Batch Size", request_batch_.size(), "Requests", 3, artdaq::MetricMode::Average);
+		metricMan->sendMetric("Fragments Sent", ev_counter(), "Events", 3, artdaq::MetricMode::LastPoint);
+	}
+	return true;
+}
+
+bool demo::ToySimulator::serve_window_requests_(artdaq::FragmentPtrs& frags)
+{
+	size_t served = 0;
+	for (auto& request : GetRequests())
+	{
+		if (lazily_handled_requests_.Contains(request.first))
+		{
+			continue;
+		}
+
+		auto begin = request.second > streaming_window_offset_ ? request.second - streaming_window_offset_ : 0;
+		auto end = begin + streaming_window_width_;
+		auto ids = fragmentIDs();
+		size_t bytes_read = 0;
+		size_t bytes_allocated = 0;
+
+		// The hardware interface sizes the readout, so let it allocate the
+		// first Fragment and copy the hits straight into its payload
+		auto allocate = [&](size_t bytes) {
+			bytes_allocated = bytes;
+			frags.emplace_back(artdaq::Fragment::FragmentBytes(bytes, request.first, ids.front(), fragment_type_, metadata_, request.second));
+			return reinterpret_cast<char*>(frags.back()->dataBeginBytes());  // NOLINT(cppcoreguidelines-pro-type-reinterpret-cast)
+		};
+		auto status = hardware_interface_->ReadWindow(begin, end, allocate, &bytes_read);
+		if (status == ToyHardwareInterface::WindowStatus::pending)
+		{
+			// Later requests have later windows, so they can't be ready either
+			break;
+		}
+		lazily_handled_requests_.Insert(request.first);
+		++served;
+
+		// Hits overwritten while the Fragment was allocated leave it oversized
+		if (bytes_read != bytes_allocated)
+		{
+			frags.back()->resizeBytes(bytes_read);
+		}
+		auto readout = reinterpret_cast<char const*>(frags.back()->dataBeginBytes());  // NOLINT(cppcoreguidelines-pro-type-reinterpret-cast)
+		for (auto id = ids.begin() + 1; id != ids.end(); ++id)
+		{
+			frags.emplace_back(artdaq::Fragment::FragmentBytes(bytes_read, request.first, *id, fragment_type_, metadata_, request.second));
+			memcpy(frags.back()->dataBeginBytes(), readout, bytes_read);
+		}
+
+		if (status == ToyHardwareInterface::WindowStatus::partial)
+		{
+			++streaming_windows_lost_;
+			TLOG(TLVL_WARNING) << "serve_window_requests_: Some hits of the window [" << begin << ", " << end << ") for sequence ID "
+			                   << request.first << " had already been overwritten";
+		}
+
+		if (metricMan != nullptr)
+		{
+			auto stats = hardware_interface_->GetStreamingStatistics();
+			metricMan->sendMetric("Streaming Window Latency", (static_cast<double>(stats.clock_ticks) - end) / stats.clock_hz, "s", 3, artdaq::MetricMode::Average);
+			metricMan->sendMetric("Streaming Window Hits", (bytes_read - sizeof(ToyFragment::Header)) / sizeof(ToyHardwareInterface::HitRecord), "Hits", 3, artdaq::MetricMode::Average);
+		}
+		ev_counter_inc(sequence_id_scale_);
+	}
+
+	if (served == 0)
+	{
+		usleep(10);
+		return true;
+	}
+
+	if (metricMan != nullptr)
+	{
+		auto stats = hardware_interface_->GetStreamingStatistics();
+		metricMan->sendMetric("Streaming Buffer Depth", stats.depth_seconds, "s", 3, artdaq::MetricMode::LastPoint);
+		metricMan->sendMetric("Streaming Windows Lost", streaming_windows_lost_, "Windows", 3, artdaq::MetricMode::LastPoint);
+		metricMan->sendMetric("Fragments Sent", ev_counter(), "Events", 3, artdaq::MetricMode::LastPoint);
+	}
+	return true;
+}
+
+void demo::ToySimulator::send_stage_metrics_()
+{
+	auto now = std::chrono::steady_clock::now();
+	auto interval = std::chrono::duration<double>(now - last_stage_metrics_).count();
+	last_stage_metrics_ = now;
+
+	// Percentiles say how long each stage takes; the duty cycle (the share of
+	// wall-clock time spent in it) says which stage the BoardReader is bound by
+	auto send = [interval](std::string const& stage, StageHistogram& histogram) {
+		auto summary = histogram.TakeSummary();
+		if (metricMan == nullptr || summary.count == 0)
+		{
+			return;
+		}
+		metricMan->sendMetric(stage + " Time P50", summary.p50_us, "us", 4, artdaq::MetricMode::LastPoint);
+		metricMan->sendMetric(stage + " Time P90", summary.p90_us, "us", 4, artdaq::MetricMode::LastPoint);
+		metricMan->sendMetric(stage + " Time P99", summary.p99_us, "us", 4, artdaq::MetricMode::LastPoint);
+		metricMan->sendMetric(stage + " Time Max", summary.max_us, "us", 4, artdaq::MetricMode::LastPoint);
+		metricMan->sendMetric(stage + " Duty Cycle", 100.0 * summary.total_seconds / interval, "%", 4, artdaq::MetricMode::LastPoint);
+		if (summary.bytes > 0 && summary.total_seconds > 0)
+		{
+			metricMan->sendMetric(stage + " Throughput", summary.bytes / summary.total_seconds, "Bytes/s", 4, artdaq::MetricMode::LastPoint);
+		}
+	};
+
+	send("Pacing Wait", pacing_wait_timer_);
+	send("Fill", fill_timer_);
+	send("Fragment Allocation", allocate_timer_);
+	send("Copy", copy_timer_);
+	send("Subrun Rollover", rollover_timer_);
+
+	auto faults = ReadoutMemory::GetPageFaults();
+	if (metricMan != nullptr)
+	{
+		metricMan->sendMetric("Minor Page Faults", (faults.minor - last_page_faults_.minor) / interval, "Faults/s", 3, artdaq::MetricMode::LastPoint);
+		metricMan->sendMetric("Major Page Faults", (faults.major - last_page_faults_.major) / interval, "Faults/s", 3, artdaq::MetricMode::LastPoint);
+	}
+	last_page_faults_ = faults;
+
+	if (metricMan != nullptr)
+	{
+		metricMan->sendMetric("Fragment Allocations", fragment_allocations_ / interval, "Fragments/s", 3, artdaq::MetricMode::LastPoint);
+	}
+	fragment_allocations_ = 0;
+	if (fragment_pool_ != nullptr)
+	{
+		auto pool = fragment_pool_->TakeStatistics();
+		if (metricMan != nullptr && pool.hits + pool.misses > 0)
+		{
+			metricMan->sendMetric("Fragment Pool Hit Rate", 100.0 * pool.hits / (pool.hits + pool.misses), "%", 3, artdaq::MetricMode::LastPoint);
+			metricMan->sendMetric("Fragment Pool Ready Bytes", pool.ready_bytes, "Bytes", 3, artdaq::MetricMode::LastPoint);
+		}
+	}
+
+	// What max_fragment_size_bytes and the shared memory's buffer_count
+	// need to accommodate, when the rate_table draws the readout sizes
+	auto sizes = hardware_interface_->TakeReadoutSizeStatistics();
+	if (metricMan != nullptr && sizes.count > 0)
+	{
+		metricMan->sendMetric("Fragment Size Mean", sizes.mean_bytes, "Bytes", 3, artdaq::MetricMode::LastPoint);
+		metricMan->sendMetric("Fragment Size P50", sizes.p50_bytes, "Bytes", 3, artdaq::MetricMode::LastPoint);
+		metricMan->sendMetric("Fragment Size P99", sizes.p99_bytes, "Bytes", 3, artdaq::MetricMode::LastPoint);
+		metricMan->sendMetric("Fragment Size Max", sizes.max_bytes, "Bytes", 3, artdaq::MetricMode::Maximum);
+	}
+}
 
 // The following macro is defined in artdaq's GeneratorMacros.hh header
 DEFINE_ARTDAQ_COMMANDABLE_GENERATOR(demo::ToySimulator)